@@ -0,0 +1,27 @@
+import argparse
+import asyncio
+from test import run
+
+# Compares placement throughput with one placement in flight per connection
+# (send, wait for the echo) against pipelined placements acked by seq.
+#
+#   ./rplace &
+#   python3 scripts/bench_pipeline.py --connections 4
+#
+# To compare two server builds under the same load, use compare_builds.py.
+
+
+async def main(args):
+    print("window  msg/s")
+    for window in args.windows:
+        sent, diff = await run(args.url, args.connections, args.duration,
+                               window)
+        print(f"{window:6}  {sent / diff:10.0f}")
+
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--url", default="ws://localhost:8081/rplace")
+parser.add_argument("--connections", type=int, default=1)
+parser.add_argument("--duration", type=float, default=10)
+parser.add_argument("--windows", type=int, nargs="+", default=[1, 8, 64, 256])
+asyncio.run(main(parser.parse_args()))
@@ -0,0 +1,101 @@
+import argparse
+import json
+import subprocess
+import sys
+import time
+from scale import wait_for_port
+
+# Runs the same loadgen workloads against two server builds, e.g. before and
+# after a change to the placement path, and prints placements/sec and p99
+# side by side. Build both first, for example:
+#
+#   git worktree add /tmp/before <commit> && cmake -S /tmp/before -B \
+#       /tmp/before/build && cmake --build /tmp/before/build --target rplace
+#   python3 scripts/compare_builds.py --before /tmp/before/build/rplace \
+#       --after build/rplace --loadgen build/loadgen > compare.jsonl
+#
+# Every workload is closed-loop in ack mode with --window placements in
+# flight per connection, so a server that serializes placements per
+# connection tops out at window 1 while a pipelined one keeps scaling. The
+# builds alternate per workload so that drift on the machine hits both.
+# --markdown prints the summary as a table to paste into a commit or docs.
+
+
+def run_build(args, server, window):
+    proc = subprocess.Popen(
+        [server,
+         f"--port={args.port}",
+         "--http-port=0",
+         "--sse-port=0",
+         *args.server_args],
+        stdout=subprocess.DEVNULL)
+    try:
+        if not wait_for_port("127.0.0.1", args.port, 10):
+            raise RuntimeError("server did not come up")
+        cmd = [args.loadgen,
+               f"--url=ws://127.0.0.1:{args.port}/rplace",
+               f"--connections={args.connections}",
+               f"--threads={args.loadgen_threads}",
+               f"--duration={args.duration}",
+               f"--window={window}",
+               "--mode=ack",
+               "--json"]
+        out = subprocess.run(cmd, check=True, capture_output=True, text=True)
+        result = json.loads(out.stdout.strip().splitlines()[-1])
+    finally:
+        proc.terminate()
+        proc.wait()
+    # Give the kernel time to release the port and its sockets.
+    time.sleep(1)
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--before", required=True, help="baseline server")
+    parser.add_argument("--after", required=True, help="changed server")
+    parser.add_argument("--loadgen", default="build/loadgen")
+    parser.add_argument("--port", type=int, default=8081)
+    parser.add_argument("--windows", type=int, nargs="+",
+                        default=[1, 8, 64, 256])
+    parser.add_argument("--connections", type=int, default=100)
+    parser.add_argument("--loadgen-threads", type=int, default=4)
+    parser.add_argument("--duration", type=float, default=10)
+    parser.add_argument("--server-args", nargs="*", default=[],
+                        help="extra options for both servers")
+    parser.add_argument("--markdown", action="store_true",
+                        help="also print the summary as a markdown table")
+    args = parser.parse_args()
+
+    rows = []
+    print(f"{'window':>6} {'before/s':>10} {'after/s':>10} {'speedup':>8} "
+          f"{'p99 before':>11} {'p99 after':>10} (us)", file=sys.stderr)
+    for window in args.windows:
+        try:
+            before = run_build(args, args.before, window)
+            after = run_build(args, args.after, window)
+        except (RuntimeError, subprocess.CalledProcessError) as err:
+            print(f"window {window}: {err}", file=sys.stderr)
+            continue
+        speedup = after["achieved"] / max(before["achieved"], 1e-9)
+        print(json.dumps({"window": window, "speedup": speedup,
+                          "before": before, "after": after}), flush=True)
+        rows.append((window, before, after, speedup))
+        print(f"{window:6} {before['achieved']:10.0f} "
+              f"{after['achieved']:10.0f} {speedup:7.2f}x "
+              f"{before['latency_us']['p99']:11.1f} "
+              f"{after['latency_us']['p99']:10.1f}", file=sys.stderr)
+
+    if args.markdown:
+        print("| window | before/s | after/s | speedup | p99 before (us) "
+              "| p99 after (us) |")
+        print("|---:|---:|---:|---:|---:|---:|")
+        for window, before, after, speedup in rows:
+            print(f"| {window} | {before['achieved']:.0f} "
+                  f"| {after['achieved']:.0f} | {speedup:.2f}x "
+                  f"| {before['latency_us']['p99']:.1f} "
+                  f"| {after['latency_us']['p99']:.1f} |")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,94 @@
+import argparse
+import asyncio
+import multiprocessing
+import resource
+import time
+from websockets.client import connect
+
+# Opens many idle connections against a running server and reports its
+# resident memory per connection. Loopback source addresses are rotated
+# (127.0.0.2, 127.0.0.3, ...) so a single box is not limited by ~28k
+# ephemeral ports per source address.
+#
+#   ulimit -n 1048576
+#   ./rplace &
+#   python3 scripts/idle_connections.py --pid $! --connections 100000
+
+
+def rss_kib(pid):
+    with open(f"/proc/{pid}/status") as f:
+        for line in f:
+            if line.startswith("VmRSS:"):
+                return int(line.split()[1])
+    return 0
+
+
+async def hold(url, count, offset, ready, hold_for):
+    connections = []
+    for i in range(count):
+        n = offset + i
+        source = f"127.0.0.{2 + n // 25000}"
+        try:
+            websocket = await connect(url, local_addr=(source, 0),
+                                      ping_interval=None, max_queue=1)
+        except OSError as err:
+            print("connect failed after", len(connections), ":", err)
+            break
+        connections.append(websocket)
+    ready.put(len(connections))
+    # Keep draining so broadcasts do not back up on the server.
+    async def drain(websocket):
+        try:
+            async for _ in websocket:
+                pass
+        except Exception:
+            pass
+    tasks = [asyncio.create_task(drain(ws)) for ws in connections]
+    await asyncio.sleep(hold_for)
+    for websocket in connections:
+        await websocket.close()
+    for task in tasks:
+        task.cancel()
+
+
+def worker(url, count, offset, ready, hold_for):
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+    asyncio.run(hold(url, count, offset, ready, hold_for))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--url", default="ws://localhost:8081/rplace")
+    parser.add_argument("--pid", type=int, required=True,
+                        help="server process to measure")
+    parser.add_argument("--connections", type=int, default=100_000)
+    parser.add_argument("--procs", type=int, default=8)
+    parser.add_argument("--hold", type=float, default=30)
+    args = parser.parse_args()
+
+    before = rss_kib(args.pid)
+    ready = multiprocessing.Queue()
+    per_proc = args.connections // args.procs
+    procs = [multiprocessing.Process(
+        target=worker,
+        args=(args.url, per_proc, i * per_proc, ready, args.hold))
+        for i in range(args.procs)]
+    start = time.time()
+    for p in procs:
+        p.start()
+    opened = sum(ready.get() for _ in procs)
+    elapsed = time.time() - start
+    time.sleep(2)
+    after = rss_kib(args.pid)
+    print("Opened", opened, "connections in", round(elapsed, 1), "s")
+    print("Server RSS", before, "KiB ->", after, "KiB")
+    if opened:
+        print("Per connection", round((after - before) * 1024 / opened),
+              "bytes")
+    for p in procs:
+        p.join()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,107 @@
+import argparse
+import json
+import os
+import socket
+import subprocess
+import sys
+import time
+
+# Runs the same loadgen workload against the server with 1..N scheduler
+# workers under both CAF scheduling policies and prints one JSON object per
+# configuration, e.g. for plotting placements/sec and p99 over workers:
+#
+#   python3 scripts/scale.py --server build/rplace --loadgen build/loadgen \
+#       --workers 1 2 4 8 --connections 1000 --duration 20 > scaling.jsonl
+#
+# Without --rate every run is closed-loop and measures peak throughput; with
+# --rate it is open-loop at that offered load and measures latency. The
+# server gets one connection group per worker, so parsing parallelism
+# follows the worker count.
+
+
+def wait_for_port(host, port, timeout):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            with socket.create_connection((host, port), timeout=0.5):
+                return True
+        except OSError:
+            time.sleep(0.1)
+    return False
+
+
+def run_config(args, policy, workers):
+    server = subprocess.Popen(
+        [args.server,
+         f"--port={args.port}",
+         "--http-port=0",
+         "--sse-port=0",
+         f"--session-groups={workers}",
+         f"--caf.scheduler.policy={policy}",
+         f"--caf.scheduler.max-threads={workers}",
+         *args.server_args],
+        stdout=subprocess.DEVNULL)
+    try:
+        if not wait_for_port("127.0.0.1", args.port, 10):
+            raise RuntimeError("server did not come up")
+        cmd = [args.loadgen,
+               f"--url=ws://127.0.0.1:{args.port}/rplace",
+               f"--connections={args.connections}",
+               f"--threads={args.loadgen_threads}",
+               f"--duration={args.duration}",
+               f"--window={args.window}",
+               "--json"]
+        if args.rate > 0:
+            cmd += [f"--rate={args.rate}", "--open-loop"]
+        out = subprocess.run(cmd, check=True, capture_output=True, text=True)
+        result = json.loads(out.stdout.strip().splitlines()[-1])
+    finally:
+        server.terminate()
+        server.wait()
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--server", default="build/rplace")
+    parser.add_argument("--loadgen", default="build/loadgen")
+    parser.add_argument("--port", type=int, default=8081)
+    parser.add_argument("--workers", type=int, nargs="+",
+                        default=[n for n in (1, 2, 4, 8, 16, 32, 64)
+                                 if n <= os.cpu_count()])
+    parser.add_argument("--policies", nargs="+",
+                        default=["stealing", "sharing"])
+    parser.add_argument("--connections", type=int, default=1000)
+    parser.add_argument("--loadgen-threads", type=int, default=4)
+    parser.add_argument("--duration", type=float, default=20)
+    parser.add_argument("--window", type=int, default=16)
+    parser.add_argument("--rate", type=float, default=0,
+                        help="offered placements/s (0 = closed-loop peak)")
+    parser.add_argument("--server-args", nargs="*", default=[],
+                        help="extra options for the server")
+    args = parser.parse_args()
+
+    for policy in args.policies:
+        for workers in args.workers:
+            try:
+                result = run_config(args, policy, workers)
+            except (RuntimeError, subprocess.CalledProcessError) as err:
+                print(f"{policy} x{workers}: {err}", file=sys.stderr)
+                continue
+            row = {"policy": policy, "workers": workers,
+                   "placements_per_sec": result["achieved"],
+                   "p50_us": result["latency_us"]["p50"],
+                   "p99_us": result["latency_us"]["p99"],
+                   "p999_us": result["latency_us"]["p999"],
+                   "loadgen": result}
+            print(json.dumps(row), flush=True)
+            print(f"{policy:9} {workers:3} workers "
+                  f"{result['achieved']:10.0f}/s "
+                  f"p99 {result['latency_us']['p99']:9.1f} us",
+                  file=sys.stderr)
+            # Give the kernel time to release the port and its sockets.
+            time.sleep(1)
+
+
+if __name__ == "__main__":
+    main()
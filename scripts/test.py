@@ -1,3 +1,4 @@
+import argparse
 import asyncio
 import time
 import json
@@ -5,31 +6,105 @@ import random
 from websockets.client import connect
 
 
-async def hello():
-    connections = []
-    diff = 10000
-    sent = [0] * 1
-    for i in range(1):
-        websocket = await connect("ws://localhost:8081/rplace")
-        connections.append(websocket)
+async def recv_echo(websocket):
+    # Broadcast batches are interleaved with the echoes; skip them.
+    while True:
+        msg = await websocket.recv()
+        if isinstance(msg, bytes):
+            continue
+        obj = json.loads(msg)
+        if obj.get("type") != "batch":
+            return obj
+
+
+def random_placement():
+    return {"x": random.randint(0, 1000), "y": random.randint(0, 1000),
+            "color": random.randint(0, 1_000_000)}
 
+
+async def send_and_wait(websocket, duration):
+    # One placement at a time, each waits for its echo.
+    sent = 0
     start = time.time()
-    while True:
-        what = {"x": random.randint(0, 1000), "y": random.randint(0, 1000),
-                "color": random.randint(0, 1_000_000)}
-        for index, websocket in enumerate(connections):
-            await websocket.send(json.dumps(what))
-            msg = await websocket.recv()
-            obj = json.loads(msg)
-            if what["x"] != obj["x"] or what["y"] != obj["y"] or what["color"] != obj["color"]:
-                print("ERROR", what, obj)
-            sent[index] += 1
-        diff = time.time() - start
-        if diff > 10:
-            break
-    print("Sent", sum(sent), "messages")
-    print("Throughput ", sum(sent) / diff, "msg/s")
-    for websocket in connections:
+    while time.time() - start < duration:
+        what = random_placement()
+        await websocket.send(json.dumps(what))
+        obj = await recv_echo(websocket)
+        if what["x"] != obj["x"] or what["y"] != obj["y"] or what["color"] != obj["color"]:
+            print("ERROR", what, obj)
+        sent += 1
+    return sent
+
+
+async def pipelined(websocket, duration, window):
+    # Keeps up to `window` placements in flight, matched by their seq.
+    in_flight = {}
+    credit = asyncio.Semaphore(window)
+    acked = 0
+
+    async def reader():
+        nonlocal acked
+        while True:
+            obj = await recv_echo(websocket)
+            if obj.get("type") != "ack":
+                continue
+            for seq, status, *_ in obj["acks"]:
+                what = in_flight.pop(seq, None)
+                if what is None:
+                    print("ERROR unexpected ack", seq)
+                    continue
+                if status != 0 and 0 <= what["x"] < 1000 and 0 <= what["y"] < 1000:
+                    print("ERROR", what, "status", status)
+                acked += 1
+                credit.release()
+
+    task = asyncio.create_task(reader())
+    seq = 0
+    start = time.time()
+    while time.time() - start < duration:
+        await credit.acquire()
+        what = random_placement()
+        what["seq"] = seq
+        in_flight[seq] = what
+        seq += 1
+        await websocket.send(json.dumps(what))
+    # Wait for the outstanding acks.
+    for _ in range(window):
+        await credit.acquire()
+    task.cancel()
+    return acked
+
+
+async def run(url, connections, duration, window):
+    sockets = []
+    for i in range(connections):
+        websocket = await connect(url)
+        sockets.append(websocket)
+
+    start = time.time()
+    if window > 1:
+        runs = [pipelined(ws, duration, window) for ws in sockets]
+    else:
+        runs = [send_and_wait(ws, duration) for ws in sockets]
+    sent = await asyncio.gather(*runs)
+    diff = time.time() - start
+    for websocket in sockets:
         await websocket.close()
+    return sum(sent), diff
+
+
+async def hello(args):
+    sent, diff = await run(args.url, args.connections, args.duration,
+                           args.window)
+    print("Sent", sent, "messages")
+    print("Throughput ", sent / diff, "msg/s")
+
 
-asyncio.run(hello())
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--url", default="ws://localhost:8081/rplace")
+    parser.add_argument("--connections", type=int, default=1)
+    parser.add_argument("--duration", type=float, default=10)
+    parser.add_argument("--window", type=int, default=1,
+                        help="placements in flight per connection (> 1 uses seq acks)")
+    asyncio.run(hello(parser.parse_args()))
@@ -0,0 +1,76 @@
+import argparse
+import asyncio
+import json
+import sys
+from websockets.client import connect
+
+# Checks how a running server answers malformed and boundary placements.
+# Start it without --batch-key and --cooldown so batches are accepted:
+#
+#   ./rplace &
+#   python3 scripts/test_protocol.py
+
+OUT_OF_BOUNDS = 1
+INVALID = 2
+
+INT32_MAX = 2**31 - 1
+INT32_MIN = -2**31
+
+# (x, y, color, expected status) for single placements acked by seq. Values
+# just outside int32 must not wrap into range.
+PLACEMENTS = [
+    (INT32_MAX + 1, 1, 1, INVALID),
+    (INT32_MIN - 1, 1, 1, INVALID),
+    (2**32 + 1, 1, 1, INVALID),  # would wrap to x = 1
+    (1, 2**32 + 1, 1, INVALID),
+    (1, 1, INT32_MAX + 1, INVALID),
+    (INT32_MAX, INT32_MIN, 1, OUT_OF_BOUNDS),
+]
+
+# (pixels, expected batch_ack) where None means {"error":"invalid"}.
+BATCHES = [
+    ([[1, 2, 3], [2**32 + 1, 1, 1]], None),
+    ([[1, 2, INT32_MIN - 1]], None),
+    ([[INT32_MAX, INT32_MIN, 3]], str(OUT_OF_BOUNDS)),
+]
+
+
+async def answer(websocket, kind):
+    # Broadcast batches and snapshots are interleaved with answers.
+    while True:
+        msg = await websocket.recv()
+        if isinstance(msg, bytes):
+            continue
+        obj = json.loads(msg)
+        if obj.get("type") == kind:
+            return obj
+
+
+async def main(args):
+    failures = 0
+    async with connect(args.url) as websocket:
+        for seq, (x, y, color, expected) in enumerate(PLACEMENTS, 1):
+            await websocket.send(json.dumps(
+                {"x": x, "y": y, "color": color, "seq": seq}))
+            obj = await answer(websocket, "ack")
+            got = {s: status for s, status, *_ in obj["acks"]}.get(seq)
+            if got != expected:
+                print("FAIL", (x, y, color), "expected", expected, "got", obj)
+                failures += 1
+        for seq, (pixels, expected) in enumerate(BATCHES, 100):
+            await websocket.send(json.dumps(
+                {"type": "place", "seq": seq, "pixels": pixels}))
+            obj = await answer(websocket, "batch_ack")
+            got = obj.get("status")
+            if obj.get("seq") != seq or got != expected:
+                print("FAIL", pixels, "expected", expected, "got", obj)
+                failures += 1
+    total = len(PLACEMENTS) + len(BATCHES)
+    print(total - failures, "of", total, "passed")
+    return failures == 0
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--url", default="ws://localhost:8081/rplace")
+    sys.exit(0 if asyncio.run(main(parser.parse_args())) else 1)
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Admission control for the canvas path, shared by all connection groups.
+//
+// Every pixel handed towards the canvas counts as in flight until its reply
+// (or timeout) comes back, and every reply updates a moving average of the
+// canvas round trip. New placements are shed while too many pixels are in
+// flight, or while the average round trip is above target and the canvas
+// still has work queued. Once the canvas drains, placements are admitted
+// again, which also refreshes the average.
+class CanvasAdmission {
+public:
+  using clock = std::chrono::steady_clock;
+
+  CanvasAdmission(int64_t max_in_flight, std::chrono::microseconds target)
+      : max_in_flight_(max_in_flight), target_us_(target.count()) {}
+
+  // Reserves `pixels` in-flight slots; false if the canvas is overloaded.
+  bool try_acquire(int64_t pixels) {
+    auto before = in_flight_.fetch_add(pixels, std::memory_order_relaxed);
+    auto slow = before > 0 && target_us_ > 0 &&
+                latency_us_.load(std::memory_order_relaxed) > target_us_;
+    if ((max_in_flight_ > 0 && before + pixels > max_in_flight_) || slow) {
+      in_flight_.fetch_sub(pixels, std::memory_order_relaxed);
+      shed_.fetch_add(pixels, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  // Returns slots taken by try_acquire once the canvas answered after
+  // `elapsed`.
+  void release(int64_t pixels, clock::duration elapsed) {
+    in_flight_.fetch_sub(pixels, std::memory_order_relaxed);
+    auto sample =
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    // EWMA with weight 1/8. Concurrent updates may lose a sample, which is
+    // fine for a load signal.
+    auto avg = latency_us_.load(std::memory_order_relaxed);
+    latency_us_.store(avg + (sample - avg) / 8, std::memory_order_relaxed);
+  }
+
+  // Returns slots of placements that never reached the canvas.
+  void cancel(int64_t pixels) {
+    in_flight_.fetch_sub(pixels, std::memory_order_relaxed);
+  }
+
+  int64_t in_flight() const {
+    return in_flight_.load(std::memory_order_relaxed);
+  }
+
+  std::chrono::microseconds latency() const {
+    return std::chrono::microseconds{
+        latency_us_.load(std::memory_order_relaxed)};
+  }
+
+  uint64_t shed() const { return shed_.load(std::memory_order_relaxed); }
+
+private:
+  int64_t max_in_flight_; // 0 = unlimited
+  int64_t target_us_;     // 0 = ignore latency
+  std::atomic<int64_t> in_flight_{0};
+  std::atomic<int64_t> latency_us_{0};
+  std::atomic<uint64_t> shed_{0};
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Parses a CPU list such as "0-3,8,10-11", the format of taskset and
+// /sys/devices/system/cpu/online. Returns false on malformed input.
+inline bool parse_cpu_list(std::string_view str, std::vector<int> &out) {
+  out.clear();
+  auto number = [](std::string_view digits, int &value) {
+    if (digits.empty() || digits.size() > 4)
+      return false;
+    value = 0;
+    for (auto c : digits) {
+      if (c < '0' || c > '9')
+        return false;
+      value = value * 10 + (c - '0');
+    }
+    return true;
+  };
+  while (!str.empty()) {
+    auto comma = str.find(',');
+    auto item = str.substr(0, comma);
+    str.remove_prefix(comma == std::string_view::npos ? str.size()
+                                                      : comma + 1);
+    auto dash = item.find('-');
+    int first = 0;
+    int last = 0;
+    if (!number(item.substr(0, dash), first))
+      return false;
+    if (dash == std::string_view::npos)
+      last = first;
+    else if (!number(item.substr(dash + 1), last) || last < first)
+      return false;
+    for (int cpu = first; cpu <= last; ++cpu)
+      out.push_back(cpu);
+  }
+  return true;
+}
+
+// Restricts the calling thread to one CPU. Only supported on Linux; returns
+// false elsewhere or if the CPU does not exist.
+inline bool pin_current_thread(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void) cpu;
+  return false;
+#endif
+}
+
+// Name of the calling thread as set by CAF, e.g. "caf.net.mpx".
+inline std::string current_thread_name() {
+#ifdef __linux__
+  char name[16] = {};
+  if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0)
+    return name;
+#endif
+  return {};
+}
+
+// Which CPUs each kind of thread goes to; empty lists leave threads alone.
+// Threads take the listed CPUs round-robin in start order.
+struct AffinityPlan {
+  std::vector<int> workers; // scheduler workers
+  std::vector<int> network; // the caf.net multiplexer
+
+  // CPU for the next scheduler worker, -1 = leave it alone.
+  int next_worker() {
+    if (workers.empty())
+      return -1;
+    return workers[next_worker_.fetch_add(1, std::memory_order_relaxed) %
+                   workers.size()];
+  }
+
+  int next_network() {
+    if (network.empty())
+      return -1;
+    return network[next_network_.fetch_add(1, std::memory_order_relaxed) %
+                   network.size()];
+  }
+
+private:
+  std::atomic<size_t> next_worker_{0};
+  std::atomic<size_t> next_network_{0};
+};
@@ -0,0 +1,192 @@
+// Microbenchmarks of the per-placement and per-batch hot paths, without
+// actors or sockets:
+//
+//   ./bench --benchmark_filter=Encode
+//
+// Canvas put/get is what canvas_matrix_actor does per placement, parsing is
+// what connection_group does per frame, batch encoding is what the broadcast
+// tick does per batch, and snapshot encoding is what connection_group does
+// per resync.
+
+#include "canvas.hpp"
+#include "encoding.hpp"
+#include "protocol.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Pre-generated random pixels, so the RNG stays out of the measurement.
+std::vector<Pixel> random_pixels(size_t n) {
+  std::mt19937 rng{42};
+  std::uniform_int_distribution<int> coord(0, DIM - 1);
+  std::uniform_int_distribution<int> color(0, 0xFFFFFF);
+  std::vector<Pixel> result(n);
+  for (auto &px : result)
+    px = Pixel{coord(rng), coord(rng), color(rng)};
+  return result;
+}
+
+std::string placement_text(const Pixel &px, uint64_t seq) {
+  return "{\"x\":" + std::to_string(px.x) + ",\"y\":" + std::to_string(px.y) +
+         ",\"color\":" + std::to_string(px.color) +
+         ",\"seq\":" + std::to_string(seq) + '}';
+}
+
+void BM_CanvasPut(benchmark::State &state) {
+  auto canvas = std::make_unique<Canvas>();
+  auto pixels = random_pixels(4096);
+  size_t i = 0;
+  for (auto _ : state) {
+    auto &px = pixels[i++ % pixels.size()];
+    benchmark::DoNotOptimize(canvas->put(px.x, px.y, px.color));
+    // Drain like the broadcast tick does, or pending_ grows without bound.
+    if (i % 4096 == 0)
+      benchmark::DoNotOptimize(canvas->take_pending());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CanvasPut);
+
+void BM_CanvasPutAll(benchmark::State &state) {
+  auto canvas = std::make_unique<Canvas>();
+  auto pixels = random_pixels(static_cast<size_t>(state.range(0)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(canvas->put_all(pixels));
+    benchmark::DoNotOptimize(canvas->take_pending());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CanvasPutAll)->Arg(64)->Arg(max_batch_pixels);
+
+void BM_CanvasGet(benchmark::State &state) {
+  auto canvas = std::make_unique<Canvas>();
+  auto pixels = random_pixels(4096);
+  for (auto &px : pixels)
+    canvas->put(px.x, px.y, px.color);
+  size_t i = 0;
+  for (auto _ : state) {
+    auto &px = pixels[i++ % pixels.size()];
+    benchmark::DoNotOptimize(canvas->get(px.x, px.y));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CanvasGet);
+
+void BM_ParsePlacement(benchmark::State &state) {
+  std::vector<std::string> frames;
+  uint64_t seq = 0;
+  for (auto &px : random_pixels(1024))
+    frames.push_back(placement_text(px, ++seq));
+  Placement place;
+  PlacementBatch batch;
+  size_t i = 0;
+  for (auto _ : state) {
+    auto &text = frames[i++ % frames.size()];
+    benchmark::DoNotOptimize(parse_message(text, place, batch));
+    benchmark::DoNotOptimize(place);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ParsePlacement);
+
+void BM_ParseBatch(benchmark::State &state) {
+  auto pixels = random_pixels(static_cast<size_t>(state.range(0)));
+  std::string text = R"({"type":"place","seq":1,"pixels":[)";
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    if (i > 0)
+      text += ',';
+    text += '[' + std::to_string(pixels[i].x) + ',' +
+            std::to_string(pixels[i].y) + ',' +
+            std::to_string(pixels[i].color) + ']';
+  }
+  text += "]}";
+  Placement place;
+  PlacementBatch batch;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(parse_message(text, place, batch));
+    benchmark::DoNotOptimize(batch);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(text.size()));
+}
+BENCHMARK(BM_ParseBatch)->Arg(64)->Arg(max_batch_pixels);
+
+void BM_EncodeBatch(benchmark::State &state) {
+  auto pixels = random_pixels(static_cast<size_t>(state.range(0)));
+  uint64_t seq = 0;
+  for (auto _ : state)
+    benchmark::DoNotOptimize(encode_batch(++seq, pixels));
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EncodeBatch)->Arg(1)->Arg(64)->Arg(max_batch_pixels);
+
+void BM_DeflateBatch(benchmark::State &state) {
+  auto text =
+      encode_batch(1, random_pixels(static_cast<size_t>(state.range(0))));
+  Deflater deflater;
+  std::vector<std::byte> out;
+  for (auto _ : state) {
+    deflater.compress(text, out);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(text.size()));
+}
+BENCHMARK(BM_DeflateBatch)->Arg(64)->Arg(max_batch_pixels);
+
+void BM_EncodeSnapshot(benchmark::State &state) {
+  auto canvas = std::make_unique<Canvas>();
+  for (auto &px : random_pixels(static_cast<size_t>(state.range(0))))
+    canvas->put(px.x, px.y, px.color);
+  Deflater deflater{Z_BEST_SPEED};
+  std::vector<std::byte> out;
+  for (auto _ : state) {
+    encode_snapshot(canvas->version(), canvas->bitmap(), &deflater, out);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * DIM * DIM * 4);
+  state.counters["frame_bytes"] = static_cast<double>(out.size());
+}
+// Empty, lightly and fully painted canvases compress very differently.
+BENCHMARK(BM_EncodeSnapshot)
+    ->Arg(0)
+    ->Arg(10'000)
+    ->Arg(DIM * DIM)
+    ->Unit(benchmark::kMillisecond);
+
+// All the canvas itself still pays per resync: the copy of the board that
+// connection groups then encode.
+void BM_CopyBoard(benchmark::State &state) {
+  auto canvas = std::make_unique<Canvas>();
+  for (auto _ : state) {
+    auto copy = std::make_shared<const std::vector<int>>(canvas->bitmap());
+    benchmark::DoNotOptimize(copy->data());
+  }
+  state.SetBytesProcessed(state.iterations() * DIM * DIM * 4);
+}
+BENCHMARK(BM_CopyBoard)->Unit(benchmark::kMicrosecond);
+
+void BM_EncodeTilePng(benchmark::State &state) {
+  auto canvas = std::make_unique<Canvas>();
+  for (auto &px : random_pixels(DIM * DIM / 4))
+    canvas->put(px.x, px.y, px.color);
+  std::vector<int> colors;
+  std::vector<std::byte> out;
+  for (auto _ : state) {
+    canvas->copy_tile(0, colors);
+    encode_png(TILE, TILE, colors, out);
+    benchmark::DoNotOptimize(out.data());
+  }
+}
+BENCHMARK(BM_EncodeTilePng);
+
+} // namespace
+
+BENCHMARK_MAIN();
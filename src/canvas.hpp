@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define DIM 1000
+#define TILE 100 // tile edge length, DIM must be a multiple
+
+struct Pixel {
+  int32_t x;
+  int32_t y;
+  int32_t color;
+};
+
+template <class Inspector> bool inspect(Inspector &f, Pixel &x) {
+  return f.object(x).fields(f.field("x", x.x), f.field("y", x.y),
+                            f.field("color", x.color));
+}
+
+// Outcome of one placement, as reported to clients in acks.
+enum class PlaceStatus : uint8_t {
+  ok = 0,
+  out_of_bounds = 1,
+  invalid = 2, // malformed message
+  failed = 3,  // the canvas did not answer in time
+  cooldown = 4, // the user placed too recently
+  busy = 5,     // shed because the canvas is overloaded, retry later
+};
+
+// Plain canvas storage, owned by canvas_matrix_actor. Every accepted put is
+// also remembered as a delta until the next broadcast batch collects it, and
+// marks its tile dirty. A tile's version is the canvas version of its latest
+// put, so versions never repeat across tiles.
+class Canvas {
+public:
+  static constexpr int tiles_per_side = DIM / TILE;
+  static constexpr int tile_count = tiles_per_side * tiles_per_side;
+
+  Canvas()
+      : bitmap_(DIM * DIM), tile_versions_(tile_count),
+        dirty_tiles_(tile_count, true) {}
+
+  static int tile_of(int x, int y) {
+    return x / TILE + (y / TILE) * tiles_per_side;
+  }
+
+  static bool in_bounds(int x, int y) {
+    return x >= 0 && x < DIM && y >= 0 && y < DIM;
+  }
+
+  PlaceStatus put(int x, int y, int color) {
+    if (!in_bounds(x, y))
+      return PlaceStatus::out_of_bounds;
+    bitmap_[x + y * DIM] = color;
+    pending_.push_back(Pixel{x, y, color});
+    ++version_;
+    auto tile = tile_of(x, y);
+    tile_versions_[tile] = version_;
+    dirty_tiles_[tile] = true;
+    return PlaceStatus::ok;
+  }
+
+  // Applies all pixels in order and returns one PlaceStatus digit per pixel.
+  std::string put_all(const std::vector<Pixel> &pixels) {
+    std::string status;
+    status.reserve(pixels.size());
+    for (auto &px : pixels)
+      status += static_cast<char>('0' + static_cast<int>(
+                                            put(px.x, px.y, px.color)));
+    return status;
+  }
+
+  int get(int x, int y) const {
+    if (!in_bounds(x, y))
+      return 0;
+    return bitmap_[x + y * DIM];
+  }
+
+  // Hands out all deltas since the last call.
+  std::vector<Pixel> take_pending() {
+    std::vector<Pixel> result;
+    result.swap(pending_);
+    return result;
+  }
+
+  bool has_pending() const { return !pending_.empty(); }
+
+  // Hands out the indexes of all tiles changed since the last call. Every
+  // tile starts out dirty.
+  std::vector<int> take_dirty_tiles() {
+    std::vector<int> result;
+    for (int tile = 0; tile < tile_count; ++tile) {
+      if (dirty_tiles_[tile]) {
+        dirty_tiles_[tile] = false;
+        result.push_back(tile);
+      }
+    }
+    return result;
+  }
+
+  uint64_t tile_version(int tile) const { return tile_versions_[tile]; }
+
+  // Copies the colors of one tile in row-major order.
+  void copy_tile(int tile, std::vector<int> &out) const {
+    auto x0 = (tile % tiles_per_side) * TILE;
+    auto y0 = (tile / tiles_per_side) * TILE;
+    out.resize(TILE * TILE);
+    for (int row = 0; row < TILE; ++row) {
+      auto first = bitmap_.begin() + x0 + (y0 + row) * DIM;
+      std::copy(first, first + TILE, out.begin() + row * TILE);
+    }
+  }
+
+  uint64_t version() const { return version_; }
+
+  const std::vector<int> &bitmap() const { return bitmap_; }
+
+private:
+  std::vector<int> bitmap_;
+  std::vector<Pixel> pending_;
+  std::vector<uint64_t> tile_versions_;
+  std::vector<bool> dirty_tiles_;
+  uint64_t version_ = 0;
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// One placement per key (user or session) per cooldown period.
+//
+// Active keys live in an open-addressed hash table (linear probing, at most
+// half full) that points into a fixed pool of nodes. Every node also sits on
+// a two-level hashed timer wheel: level 0 has one slot per tick, level 1 one
+// slot per 256 ticks and is cascaded into level 0 whenever level 0 wraps.
+// Checks, inserts and expiries are O(1), and all memory is allocated up front
+// for `capacity` concurrent cooldowns.
+class CooldownTable {
+public:
+  using clock = std::chrono::steady_clock;
+  using duration = std::chrono::milliseconds;
+
+  static constexpr uint32_t slots = 256;
+  static constexpr uint64_t span = uint64_t{slots} * slots; // in ticks
+
+  // Longest cooldown the wheel holds at `resolution`, about 109 minutes at
+  // the default 100 ms. Callers must reject longer ones.
+  static constexpr duration max_cooldown(duration resolution = duration{100}) {
+    return resolution * static_cast<duration::rep>(span - 1);
+  }
+
+  CooldownTable(size_t capacity, duration cooldown,
+                duration resolution = duration{100},
+                clock::time_point now = clock::now())
+      : resolution_(resolution.count() > 0 ? resolution : duration{1}),
+        epoch_(now), nodes_(capacity) {
+    size_t buckets = 1;
+    while (buckets < capacity * 2)
+      buckets <<= 1;
+    buckets_.resize(buckets);
+    clear();
+    auto ticks = (cooldown + resolution_ - duration{1}) / resolution_;
+    cooldown_ticks_ = static_cast<uint64_t>(ticks);
+    if (cooldown_ticks_ == 0)
+      cooldown_ticks_ = 1;
+    // Only reachable past max_cooldown(), which callers rule out.
+    if (cooldown_ticks_ >= span)
+      cooldown_ticks_ = span - 1;
+  }
+
+  // Returns zero and starts the cooldown of `key` if it may place now,
+  // otherwise the time left. Fails closed when the table is full.
+  duration try_acquire(uint64_t key, clock::time_point now = clock::now()) {
+    advance(now);
+    auto bucket = find(key);
+    if (buckets_[bucket] != npos) {
+      auto left = nodes_[buckets_[bucket]].expires - tick_;
+      return duration{static_cast<duration::rep>(left)} * resolution_.count();
+    }
+    if (free_ == npos)
+      return resolution_;
+    auto index = free_;
+    free_ = nodes_[index].next;
+    auto &node = nodes_[index];
+    node.key = key;
+    node.expires = tick_ + cooldown_ticks_;
+    buckets_[bucket] = index;
+    schedule(index);
+    ++size_;
+    return duration{0};
+  }
+
+  // Expires every cooldown that ended before `now`.
+  void advance(clock::time_point now) {
+    if (now < epoch_)
+      return;
+    auto target = static_cast<uint64_t>((now - epoch_) / resolution_);
+    if (target <= tick_)
+      return;
+    if (size_ == 0 || target - tick_ >= span) {
+      // Nothing to expire tick by tick, or everything expired anyway.
+      if (size_ != 0)
+        clear();
+      tick_ = target;
+      return;
+    }
+    while (tick_ < target) {
+      ++tick_;
+      if ((tick_ & (slots - 1)) == 0)
+        cascade(level1_[(tick_ / slots) & (slots - 1)]);
+      auto &head = level0_[tick_ & (slots - 1)];
+      while (head != npos) {
+        auto index = head;
+        head = nodes_[index].next;
+        release(index);
+      }
+    }
+  }
+
+  size_t size() const { return size_; }
+
+  size_t capacity() const { return nodes_.size(); }
+
+private:
+  static constexpr uint32_t npos = UINT32_MAX;
+
+  struct Node {
+    uint64_t key = 0;
+    uint64_t expires = 0; // tick
+    uint32_t next = npos; // wheel slot list or free list
+  };
+
+  static uint64_t mix(uint64_t x) {
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  // Bucket holding `key`, or the empty bucket where it belongs.
+  size_t find(uint64_t key) const {
+    auto mask = buckets_.size() - 1;
+    for (auto i = mix(key) & mask;; i = (i + 1) & mask)
+      if (buckets_[i] == npos || nodes_[buckets_[i]].key == key)
+        return i;
+  }
+
+  void schedule(uint32_t index) {
+    auto &node = nodes_[index];
+    auto &head = node.expires - tick_ < slots
+                     ? level0_[node.expires & (slots - 1)]
+                     : level1_[(node.expires / slots) & (slots - 1)];
+    node.next = head;
+    head = index;
+  }
+
+  void cascade(uint32_t &head) {
+    auto index = head;
+    head = npos;
+    while (index != npos) {
+      auto next = nodes_[index].next;
+      schedule(index);
+      index = next;
+    }
+  }
+
+  // Removes the node from the hash table (backward-shift deletion keeps
+  // probe sequences intact without tombstones) and frees it.
+  void release(uint32_t index) {
+    auto mask = buckets_.size() - 1;
+    auto hole = find(nodes_[index].key);
+    auto i = (hole + 1) & mask;
+    for (; buckets_[i] != npos; i = (i + 1) & mask) {
+      auto home = mix(nodes_[buckets_[i]].key) & mask;
+      // Move the entry into the hole unless its home lies in (hole, i].
+      if (((i - home) & mask) >= ((i - hole) & mask)) {
+        buckets_[hole] = buckets_[i];
+        hole = i;
+      }
+    }
+    buckets_[hole] = npos;
+    nodes_[index].next = free_;
+    free_ = index;
+    --size_;
+  }
+
+  void clear() {
+    buckets_.assign(buckets_.size(), npos);
+    for (auto &head : level0_)
+      head = npos;
+    for (auto &head : level1_)
+      head = npos;
+    for (uint32_t i = 0; i < nodes_.size(); ++i)
+      nodes_[i].next = i + 1 < nodes_.size() ? i + 1 : npos;
+    free_ = nodes_.empty() ? npos : 0;
+    size_ = 0;
+  }
+
+  duration resolution_;
+  clock::time_point epoch_;
+  uint64_t tick_ = 0;
+  uint64_t cooldown_ticks_ = 0;
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> buckets_;
+  uint32_t level0_[slots];
+  uint32_t level1_[slots];
+  uint32_t free_ = npos;
+  size_t size_ = 0;
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "canvas.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <zlib.h>
+
+// {"type":"batch","seq":N,"pixels":[[x,y,color],...]}
+inline std::string encode_batch(uint64_t seq, const std::vector<Pixel> &pixels) {
+  std::string out;
+  out.reserve(40 + pixels.size() * 24);
+  out += R"({"type":"batch","seq":)";
+  out += std::to_string(seq);
+  out += R"(,"pixels":[)";
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    if (i > 0)
+      out += ',';
+    out += '[';
+    out += std::to_string(pixels[i].x);
+    out += ',';
+    out += std::to_string(pixels[i].y);
+    out += ',';
+    out += std::to_string(pixels[i].color);
+    out += ']';
+  }
+  out += "]}";
+  return out;
+}
+
+// Raw DEFLATE without zlib header. The stream is reset before every call, so
+// each output is decodable on its own (no context takeover) and the same bytes
+// can be handed to any number of sessions.
+class Deflater {
+public:
+  explicit Deflater(int level = Z_DEFAULT_COMPRESSION) {
+    stream_.zalloc = Z_NULL;
+    stream_.zfree = Z_NULL;
+    stream_.opaque = Z_NULL;
+    ok_ = deflateInit2(&stream_, level, Z_DEFLATED, -MAX_WBITS, 8,
+                       Z_DEFAULT_STRATEGY) == Z_OK;
+  }
+
+  Deflater(const Deflater &) = delete;
+  Deflater &operator=(const Deflater &) = delete;
+
+  ~Deflater() {
+    if (ok_)
+      deflateEnd(&stream_);
+  }
+
+  bool compress(std::string_view in, std::vector<std::byte> &out) {
+    if (!ok_ || deflateReset(&stream_) != Z_OK)
+      return false;
+    out.resize(deflateBound(&stream_, static_cast<uLong>(in.size())));
+    stream_.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    stream_.avail_in = static_cast<uInt>(in.size());
+    stream_.next_out = reinterpret_cast<Bytef *>(out.data());
+    stream_.avail_out = static_cast<uInt>(out.size());
+    if (deflate(&stream_, Z_FINISH) != Z_STREAM_END)
+      return false;
+    out.resize(stream_.total_out);
+    return true;
+  }
+
+private:
+  z_stream stream_;
+  bool ok_ = false;
+};
+
+// Binary snapshot frame: "RPSN", seq (u64), width (u16), height (u16), all
+// little-endian, followed by width * height u32 colors in row-major order.
+// The colors are raw DEFLATE compressed if `deflater` is set, which only
+// sessions that negotiated ?compression=deflate get; everyone else gets them
+// as they are. Batches with a sequence number above seq apply on top.
+inline bool encode_snapshot(uint64_t seq, const std::vector<int> &bitmap,
+                            Deflater *deflater, std::vector<std::byte> &out) {
+  std::string raw;
+  raw.resize(bitmap.size() * 4);
+  for (size_t i = 0; i < bitmap.size(); ++i) {
+    auto color = static_cast<uint32_t>(bitmap[i]);
+    for (size_t b = 0; b < 4; ++b)
+      raw[i * 4 + b] = static_cast<char>((color >> (8 * b)) & 0xFF);
+  }
+  std::vector<std::byte> body;
+  if (deflater != nullptr && !deflater->compress(raw, body))
+    return false;
+  out.clear();
+  out.reserve(16 + (deflater != nullptr ? body.size() : raw.size()));
+  auto put_le = [&out](uint64_t value, size_t bytes) {
+    for (size_t b = 0; b < bytes; ++b)
+      out.push_back(static_cast<std::byte>((value >> (8 * b)) & 0xFF));
+  };
+  for (char c : {'R', 'P', 'S', 'N'})
+    out.push_back(static_cast<std::byte>(c));
+  put_le(seq, 8);
+  put_le(DIM, 2);
+  put_le(DIM, 2);
+  if (deflater != nullptr)
+    out.insert(out.end(), body.begin(), body.end());
+  else
+    for (char c : raw)
+      out.push_back(static_cast<std::byte>(c));
+  return true;
+}
+
+// Truecolor 8-bit PNG of `width` x `height` colors (0xRRGGBB), row-major.
+inline bool encode_png(int width, int height, const std::vector<int> &colors,
+                       std::vector<std::byte> &out) {
+  // Scanlines with filter type 0 in front of every row.
+  std::vector<Bytef> raw;
+  raw.reserve(static_cast<size_t>(height) * (1 + width * 3));
+  for (int y = 0; y < height; ++y) {
+    raw.push_back(0);
+    for (int x = 0; x < width; ++x) {
+      auto color = static_cast<uint32_t>(colors[x + y * width]);
+      raw.push_back(static_cast<Bytef>((color >> 16) & 0xFF));
+      raw.push_back(static_cast<Bytef>((color >> 8) & 0xFF));
+      raw.push_back(static_cast<Bytef>(color & 0xFF));
+    }
+  }
+  std::vector<Bytef> idat(compressBound(static_cast<uLong>(raw.size())));
+  auto idat_len = static_cast<uLongf>(idat.size());
+  if (compress2(idat.data(), &idat_len, raw.data(),
+                static_cast<uLong>(raw.size()), Z_BEST_SPEED) != Z_OK)
+    return false;
+  out.clear();
+  auto put_be32 = [&out](uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+      out.push_back(static_cast<std::byte>((value >> shift) & 0xFF));
+  };
+  auto chunk = [&](const char *type, const Bytef *data, size_t len) {
+    put_be32(static_cast<uint32_t>(len));
+    auto first = out.size();
+    for (int i = 0; i < 4; ++i)
+      out.push_back(static_cast<std::byte>(type[i]));
+    for (size_t i = 0; i < len; ++i)
+      out.push_back(static_cast<std::byte>(data[i]));
+    auto crc = crc32(0L, reinterpret_cast<const Bytef *>(&out[first]),
+                     static_cast<uInt>(out.size() - first));
+    put_be32(static_cast<uint32_t>(crc));
+  };
+  static constexpr Bytef signature[] = {0x89, 'P', 'N', 'G', '\r', '\n',
+                                        0x1A, '\n'};
+  for (auto b : signature)
+    out.push_back(static_cast<std::byte>(b));
+  Bytef ihdr[13] = {};
+  for (int i = 0; i < 4; ++i) {
+    ihdr[i] = static_cast<Bytef>((width >> (24 - 8 * i)) & 0xFF);
+    ihdr[4 + i] = static_cast<Bytef>((height >> (24 - 8 * i)) & 0xFF);
+  }
+  ihdr[8] = 8;  // bit depth
+  ihdr[9] = 2;  // color type: truecolor
+  chunk("IHDR", ihdr, sizeof(ihdr));
+  chunk("IDAT", idat.data(), idat_len);
+  chunk("IEND", nullptr, 0);
+  return true;
+}
+
+struct CompressionStats {
+  uint64_t batches = 0;
+  uint64_t raw_bytes = 0;
+  uint64_t packed_bytes = 0;
+  std::chrono::nanoseconds cpu{0};
+
+  void record(size_t raw, size_t packed, std::chrono::nanoseconds elapsed) {
+    ++batches;
+    raw_bytes += raw;
+    packed_bytes += packed;
+    cpu += elapsed;
+  }
+
+  // Compressed size relative to the input, e.g. 0.25 for a 4:1 reduction.
+  double ratio() const {
+    return raw_bytes == 0 ? 1.0
+                          : static_cast<double>(packed_bytes) / raw_bytes;
+  }
+
+  double cpu_us_per_batch() const {
+    return batches == 0 ? 0.0 : cpu.count() / 1000.0 / batches;
+  }
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+// One background thread that periodically runs the flush callbacks of the
+// file writers (Tracer, PlacementRecorder), so each of them does not need a
+// thread of its own. Callbacks run every 500 ms, one after another.
+class Flusher {
+public:
+  Flusher() = default;
+
+  Flusher(const Flusher &) = delete;
+  Flusher &operator=(const Flusher &) = delete;
+
+  ~Flusher() {
+    {
+      std::lock_guard<std::mutex> guard{mtx_};
+      if (!thread_.joinable())
+        return;
+      stopping_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+  }
+
+  // Registers `fn` and returns an id for remove(). Starts the thread on the
+  // first call.
+  uint64_t add(std::function<void()> fn) {
+    std::lock_guard<std::mutex> guard{mtx_};
+    auto id = next_id_++;
+    callbacks_.emplace(id, std::move(fn));
+    if (!thread_.joinable())
+      thread_ = std::thread{[this] { run(); }};
+    return id;
+  }
+
+  // Unregisters a callback. Callbacks run under the lock, so once this
+  // returns the callback is neither running nor going to run again.
+  void remove(uint64_t id) {
+    std::lock_guard<std::mutex> guard{mtx_};
+    callbacks_.erase(id);
+  }
+
+private:
+  void run() {
+    std::unique_lock<std::mutex> guard{mtx_};
+    while (!stopping_) {
+      cv_.wait_for(guard, std::chrono::milliseconds(500));
+      for (auto &entry : callbacks_)
+        entry.second();
+    }
+  }
+
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  std::map<uint64_t, std::function<void()>> callbacks_;
+  uint64_t next_id_ = 1;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+inline Flusher &flusher() {
+  static Flusher instance;
+  return instance;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Log-linear latency histogram in the spirit of HdrHistogram. Values below
+// 32 ns get one bucket each, larger ones 32 buckets per power of two, so a
+// bucket never spans more than ~3% of its values. Values are clamped at
+// 2^40 ns (~18 minutes). Fixed size, so recording never allocates.
+//
+// Like the counters in metrics.hpp, each histogram has a single writer;
+// readers may merge it from any thread at any time.
+class LatencyHistogram {
+public:
+  static constexpr int sub_bits = 5;
+  static constexpr uint64_t sub_count = uint64_t{1} << sub_bits;
+  static constexpr int max_bits = 40;
+  static constexpr size_t bucket_count = (max_bits - sub_bits + 1) * sub_count;
+
+  static size_t index_of(uint64_t ns) {
+    ns = std::min(ns, (uint64_t{1} << max_bits) - 1);
+    if (ns < sub_count)
+      return static_cast<size_t>(ns);
+    auto shift = 63 - __builtin_clzll(ns) - sub_bits;
+    return static_cast<size_t>((shift + 1) * sub_count + (ns >> shift) -
+                               sub_count);
+  }
+
+  // Largest value that lands in bucket `index`.
+  static uint64_t upper_bound(size_t index) {
+    if (index < sub_count)
+      return index;
+    auto shift = index / sub_count - 1;
+    auto sub = index % sub_count + sub_count;
+    return ((sub + 1) << shift) - 1;
+  }
+
+  // Merged view of one or more histograms.
+  struct Snapshot {
+    std::array<uint64_t, bucket_count> buckets{};
+    uint64_t count = 0;
+    uint64_t sum = 0; // ns
+    uint64_t max = 0; // ns
+
+    // Upper bound of the bucket holding quantile `q` (0..1), in ns.
+    uint64_t quantile(double q) const {
+      if (count == 0)
+        return 0;
+      auto rank = static_cast<uint64_t>(q * static_cast<double>(count));
+      rank = std::clamp<uint64_t>(rank, 1, count);
+      uint64_t seen = 0;
+      for (size_t i = 0; i < bucket_count; ++i) {
+        seen += buckets[i];
+        if (seen >= rank)
+          return std::min(upper_bound(i), max);
+      }
+      return max;
+    }
+  };
+
+  void record(uint64_t ns) {
+    bump(buckets_[index_of(ns)], 1);
+    bump(count_, 1);
+    bump(sum_, ns);
+    if (ns > max_.load(std::memory_order_relaxed))
+      max_.store(ns, std::memory_order_relaxed);
+  }
+
+  void merge_into(Snapshot &out) const {
+    for (size_t i = 0; i < bucket_count; ++i)
+      out.buckets[i] += buckets_[i].load(std::memory_order_relaxed);
+    out.count += count_.load(std::memory_order_relaxed);
+    out.sum += sum_.load(std::memory_order_relaxed);
+    out.max = std::max(out.max, max_.load(std::memory_order_relaxed));
+  }
+
+private:
+  static void bump(std::atomic<uint64_t> &value, uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+  }
+
+  std::array<std::atomic<uint64_t>, bucket_count> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
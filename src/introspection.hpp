@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Load of one long-lived actor: messages handled, time spent handling them
+// and its mailbox size as last sampled by the actor itself. Only the actor
+// writes, anyone may read.
+class ActorProbe {
+public:
+  using clock = std::chrono::steady_clock;
+
+  ActorProbe(std::string name, uint64_t id) : name_(std::move(name)), id_(id) {}
+
+  // Times everything until the end of the scope as one handled message.
+  class Scope {
+  public:
+    explicit Scope(ActorProbe &probe) : probe_(probe), start_(clock::now()) {}
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+    ~Scope() { probe_.record(clock::now() - start_); }
+
+  private:
+    ActorProbe &probe_;
+    clock::time_point start_;
+  };
+
+  void record(clock::duration elapsed) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+    messages_.store(messages_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    busy_ns_.store(busy_ns_.load(std::memory_order_relaxed) +
+                       static_cast<uint64_t>(ns.count()),
+                   std::memory_order_relaxed);
+  }
+
+  void sample_mailbox(size_t size) {
+    mailbox_.store(size, std::memory_order_relaxed);
+  }
+
+  const std::string &name() const { return name_; }
+
+  uint64_t id() const { return id_; }
+
+  uint64_t messages() const {
+    return messages_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t busy_ns() const { return busy_ns_.load(std::memory_order_relaxed); }
+
+  size_t mailbox() const { return mailbox_.load(std::memory_order_relaxed); }
+
+private:
+  std::string name_;
+  uint64_t id_;
+  std::atomic<uint64_t> messages_{0};
+  std::atomic<uint64_t> busy_ns_{0};
+  std::atomic<size_t> mailbox_{0};
+};
+
+using ActorProbePtr = std::shared_ptr<ActorProbe>;
+
+// CPU time of one thread of this process, from /proc (Linux only).
+struct ThreadSample {
+  int tid;
+  std::string name;
+  double cpu_seconds;
+};
+
+inline std::vector<ThreadSample> sample_threads() {
+  std::vector<ThreadSample> result;
+#ifdef __linux__
+  auto ticks = static_cast<double>(sysconf(_SC_CLK_TCK));
+  auto *dir = opendir("/proc/self/task");
+  if (dir == nullptr)
+    return result;
+  while (auto *entry = readdir(dir)) {
+    if (entry->d_name[0] == '.')
+      continue;
+    auto base = std::string{"/proc/self/task/"} + entry->d_name;
+    std::ifstream stat{base + "/stat"};
+    std::string line;
+    if (!std::getline(stat, line))
+      continue;
+    // utime and stime are fields 14 and 15, the name in field 2 may contain
+    // spaces, so count from the closing parenthesis.
+    auto paren = line.rfind(')');
+    if (paren == std::string::npos)
+      continue;
+    std::istringstream fields{line.substr(paren + 2)};
+    std::string field;
+    double utime = 0;
+    double stime = 0;
+    for (int i = 3; i <= 15 && fields >> field; ++i) {
+      if (i == 14)
+        utime = std::stod(field);
+      else if (i == 15)
+        stime = std::stod(field);
+    }
+    std::ifstream comm{base + "/comm"};
+    std::string name;
+    std::getline(comm, name);
+    result.push_back(
+        ThreadSample{std::atoi(entry->d_name), name, (utime + stime) / ticks});
+  }
+  closedir(dir);
+  std::sort(result.begin(), result.end(),
+            [](const auto &a, const auto &b) { return a.tid < b.tid; });
+#endif
+  return result;
+}
+
+// All probes plus the thread sampler, rendered for /metrics and as a plain
+// text table for /debug/actors. The table shows utilization since the
+// previous table, so refreshing it during an incident shows the current load.
+class Introspection {
+public:
+  using clock = ActorProbe::clock;
+
+  ActorProbePtr add(std::string name, uint64_t id) {
+    auto probe = std::make_shared<ActorProbe>(std::move(name), id);
+    std::lock_guard<std::mutex> guard{mtx_};
+    probes_.push_back(probe);
+    return probe;
+  }
+
+  void render(std::string &out) {
+    auto probes = live();
+    auto labels = [](const ActorProbe &probe) {
+      return "{actor=\"" + probe.name() + "\",id=\"" +
+             std::to_string(probe.id()) + "\"} ";
+    };
+    // Each family in one block under its own TYPE line.
+    out += "# TYPE rplace_actor_messages_total counter\n";
+    for (auto &probe : probes)
+      out += "rplace_actor_messages_total" + labels(*probe) +
+             std::to_string(probe->messages()) + '\n';
+    out += "# TYPE rplace_actor_busy_seconds_total counter\n";
+    for (auto &probe : probes)
+      out += "rplace_actor_busy_seconds_total" + labels(*probe) +
+             std::to_string(probe->busy_ns() / 1e9) + '\n';
+    out += "# TYPE rplace_actor_mailbox gauge\n";
+    for (auto &probe : probes)
+      out += "rplace_actor_mailbox" + labels(*probe) +
+             std::to_string(probe->mailbox()) + '\n';
+    out += "# TYPE rplace_thread_cpu_seconds_total counter\n";
+    for (auto &thread : sample_threads())
+      out += "rplace_thread_cpu_seconds_total{thread=\"" + thread.name +
+             "\",tid=\"" + std::to_string(thread.tid) + "\"} " +
+             std::to_string(thread.cpu_seconds) + '\n';
+  }
+
+  std::string report() {
+    auto now = clock::now();
+    auto probes = live();
+    auto threads = sample_threads();
+    std::lock_guard<std::mutex> guard{report_mtx_};
+    std::chrono::duration<double> wall = now - last_report_;
+    last_report_ = now;
+    std::string out;
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-20s %8s %8s %12s %7s\n", "actor",
+                  "id", "mailbox", "messages", "busy%");
+    out += line;
+    std::map<const ActorProbe *, uint64_t> actors;
+    for (auto &probe : probes) {
+      auto last = last_actors_[probe.get()];
+      auto busy = (probe->busy_ns() - last) / 1e9 / wall.count() * 100;
+      actors[probe.get()] = probe->busy_ns();
+      std::snprintf(line, sizeof(line), "%-20s %8llu %8zu %12llu %7.1f\n",
+                    probe->name().c_str(),
+                    static_cast<unsigned long long>(probe->id()),
+                    probe->mailbox(),
+                    static_cast<unsigned long long>(probe->messages()), busy);
+      out += line;
+    }
+    std::snprintf(line, sizeof(line), "\n%-20s %8s %7s\n", "thread", "tid",
+                  "cpu%");
+    out += line;
+    std::map<int, double> cpu_seconds;
+    for (auto &thread : threads) {
+      auto last = last_threads_[thread.tid];
+      auto cpu = (thread.cpu_seconds - last) / wall.count() * 100;
+      cpu_seconds[thread.tid] = thread.cpu_seconds;
+      std::snprintf(line, sizeof(line), "%-20s %8d %7.1f\n",
+                    thread.name.c_str(), thread.tid, cpu);
+      out += line;
+    }
+    // Forget actors and threads that are gone.
+    last_actors_.swap(actors);
+    last_threads_.swap(cpu_seconds);
+    return out;
+  }
+
+private:
+  // Probes of running actors, in registration order. Actors own their probe
+  // via their state, so probes of terminated actors expire here.
+  std::vector<ActorProbePtr> live() {
+    std::vector<ActorProbePtr> result;
+    std::lock_guard<std::mutex> guard{mtx_};
+    probes_.erase(std::remove_if(probes_.begin(), probes_.end(),
+                                 [&](const std::weak_ptr<ActorProbe> &ptr) {
+                                   auto probe = ptr.lock();
+                                   if (!probe)
+                                     return true;
+                                   result.push_back(std::move(probe));
+                                   return false;
+                                 }),
+                  probes_.end());
+    return result;
+  }
+
+  std::mutex mtx_;
+  std::vector<std::weak_ptr<ActorProbe>> probes_;
+  std::mutex report_mtx_;
+  clock::time_point last_report_ = clock::now();
+  std::map<const ActorProbe *, uint64_t> last_actors_;
+  std::map<int, double> last_threads_;
+};
+
+inline Introspection &introspection() {
+  static Introspection instance;
+  return instance;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Listening socket for the WebSocket acceptor. Accepted connections inherit
+// the buffer sizes of the listener, so a small `buffer_size` caps the kernel
+// memory of every idle connection. With `reuse_port`, several listeners may
+// bind the same port and the kernel load-balances connections across them.
+// Listens on IPv6 and IPv4 alike, or on IPv4 only if the host has no IPv6.
+// Returns -1 and sets `err` on failure.
+inline int make_listen_socket(uint16_t port, int buffer_size, bool reuse_port,
+                              std::string &err) {
+  auto fail = [&err](int fd, const char *what) {
+    err = std::string{what} + ": " + std::strerror(errno);
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  };
+  int family = AF_INET6;
+  int fd = socket(family, SOCK_STREAM, 0);
+  if (fd < 0 && errno == EAFNOSUPPORT) {
+    family = AF_INET;
+    fd = socket(family, SOCK_STREAM, 0);
+  }
+  if (fd < 0)
+    return fail(fd, "socket");
+  if (fcntl(fd, F_SETFL, O_NONBLOCK) != 0 ||
+      fcntl(fd, F_SETFD, FD_CLOEXEC) != 0)
+    return fail(fd, "fcntl");
+  int on = 1;
+  int off = 0;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+      (family == AF_INET6 &&
+       setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) != 0))
+    return fail(fd, "setsockopt");
+  if (reuse_port &&
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+    return fail(fd, "setsockopt");
+  if (buffer_size > 0 &&
+      (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size,
+                  sizeof(buffer_size)) != 0 ||
+       setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_size,
+                  sizeof(buffer_size)) != 0))
+    return fail(fd, "setsockopt");
+  sockaddr_in6 addr6{};
+  addr6.sin6_family = AF_INET6;
+  addr6.sin6_addr = in6addr_any;
+  addr6.sin6_port = htons(port);
+  sockaddr_in addr4{};
+  addr4.sin_family = AF_INET;
+  addr4.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr4.sin_port = htons(port);
+  auto bound = family == AF_INET6
+                   ? bind(fd, reinterpret_cast<sockaddr *>(&addr6),
+                          sizeof(addr6))
+                   : bind(fd, reinterpret_cast<sockaddr *>(&addr4),
+                          sizeof(addr4));
+  if (bound != 0)
+    return fail(fd, "bind");
+  if (listen(fd, SOMAXCONN) != 0)
+    return fail(fd, "listen");
+  return fd;
+}
+
+// Every connection costs a file descriptor; lift the soft limit as far as the
+// hard limit allows and return the new value.
+inline rlim_t raise_fd_limit() {
+  rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+    return 0;
+  if (rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) != 0)
+      getrlimit(RLIMIT_NOFILE, &rl);
+  }
+  return rl.rlim_cur;
+}
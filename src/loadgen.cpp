@@ -0,0 +1,1031 @@
+// Load generator for the /rplace WebSocket endpoint, without CAF:
+//
+//   loadgen --url ws://localhost:8081/rplace --connections 2000
+//           --threads 4 --rate 50000 --duration 30 --mode ack
+//
+// Every thread owns a share of the connections and drives them with poll().
+// Once all connections are up, placements are spread round-robin over them at
+// --rate per second in total (0 = as fast as the window allows). In "ack"
+// mode placements carry a seq and up to --window of them may be in flight per
+// connection; in "echo" mode they carry none and each waits for its echo,
+// which must match the placement sent.
+// The first connection of every thread also watches the broadcast batches
+// and measures when its thread's placements become visible.
+//
+// By default the load is closed-loop: a send slot that finds every window
+// full is skipped, so a server stall slows the client down and the stall
+// shows up in few samples (coordinated omission). With --open-loop every
+// placement has a fixed intended send time and goes out no matter how many
+// are in flight, and latency counts from the intended time. --sweep runs one
+// open-loop step per offered rate and prints a row per step:
+//
+//   loadgen --open-loop --sweep 10000,20000,50000,100000 --duration 20
+//
+// --replay plays back a trace recorded by the server's --record-file, open
+// loop, at the recorded pace times --speed. Every recorded session keeps
+// using the same connection, so its placements stay in order:
+//
+//   loadgen --replay placements.rptr --speed 4 --connections 1000
+//
+// --json prints a single JSON object instead of the report, for scripts.
+
+#include "canvas.hpp"
+#include "histogram.hpp"
+#include "recording.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // SO_NOSIGPIPE is set per socket instead
+#endif
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct Options {
+  std::string url = "ws://localhost:8081/rplace";
+  size_t connections = 100;
+  size_t threads = 1;
+  double rate = 0;     // placements per second over all connections
+  double duration = 10; // seconds of sending
+  std::string mode = "ack";
+  size_t window = 16; // in-flight placements per connection in ack mode
+  bool open_loop = false;
+  std::vector<double> sweep; // offered rates, one step each
+  std::string replay;        // trace file, replaces random placements
+  double speed = 1;          // replay pace relative to the recording
+  bool json = false;
+};
+
+struct Url {
+  std::string host;
+  std::string port;
+  std::string target; // path and query
+};
+
+bool parse_url(std::string_view url, Url &out) {
+  if (url.substr(0, 5) != "ws://")
+    return false;
+  url.remove_prefix(5);
+  auto slash = url.find('/');
+  auto authority = url.substr(0, slash);
+  out.target = slash == std::string_view::npos ? "/"
+                                               : std::string{url.substr(slash)};
+  auto colon = authority.rfind(':');
+  if (colon == std::string_view::npos) {
+    out.host = authority;
+    out.port = "80";
+  } else {
+    out.host = authority.substr(0, colon);
+    out.port = authority.substr(colon + 1);
+  }
+  return !out.host.empty();
+}
+
+// Counters and histograms of one thread, merged at the end.
+struct Stats {
+  uint64_t connected = 0;
+  uint64_t failed = 0;
+  uint64_t closed = 0; // by the server after the handshake
+  uint64_t sent = 0;
+  uint64_t missed = 0; // send slots with no connection ready
+  uint64_t max_lag_ns = 0; // open loop: worst delay of a send behind schedule
+  uint64_t answered = 0;
+  uint64_t unanswered = 0; // still pending at the deadline or on close
+  uint64_t statuses[6] = {}; // by PlaceStatus
+  uint64_t unexpected = 0;   // acks or echoes that match nothing we sent
+  uint64_t mismatched = 0;   // echoes that differ from the placement sent
+  uint64_t notices = 0;      // busy, cooldown and rate_limited messages
+  uint64_t batches = 0;
+  uint64_t gaps = 0; // missing batch seqs, i.e. the observer fell behind
+  uint64_t snapshots = 0;
+  uint64_t visible = 0;
+  // From the intended send time. Same as `service` in closed-loop mode.
+  std::unique_ptr<LatencyHistogram> latency =
+      std::make_unique<LatencyHistogram>();
+  // From the actual send time, i.e. what a closed-loop client would report.
+  std::unique_ptr<LatencyHistogram> service =
+      std::make_unique<LatencyHistogram>();
+  std::unique_ptr<LatencyHistogram> visibility =
+      std::make_unique<LatencyHistogram>();
+};
+
+enum class ConnState { connecting, upgrading, open, closed };
+
+struct SendTime {
+  clock_type::time_point intended;
+  clock_type::time_point actual;
+};
+
+// Placement waiting for its echo, kept to check what comes back.
+struct Echo {
+  SendTime sent;
+  Pixel px;
+};
+
+struct Connection {
+  int fd = -1;
+  ConnState state = ConnState::connecting;
+  bool observer = false;
+  std::string in;
+  std::string out;
+  size_t out_offset = 0;
+  uint64_t next_seq = 1;
+  uint64_t last_batch = 0;
+  std::unordered_map<uint64_t, SendTime> in_flight; // ack mode
+  std::deque<Echo> echoes;                          // echo mode
+};
+
+// Reads the next unsigned integer at or after `pos`.
+bool next_number(std::string_view text, size_t &pos, uint64_t &out) {
+  while (pos < text.size() && (text[pos] < '0' || text[pos] > '9'))
+    ++pos;
+  if (pos == text.size())
+    return false;
+  out = 0;
+  while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9')
+    out = out * 10 + static_cast<uint64_t>(text[pos++] - '0');
+  return true;
+}
+
+uint64_t pixel_key(uint64_t x, uint64_t y, uint64_t color) {
+  return (x << 44) | (y << 24) | (color & 0xFFFFFF);
+}
+
+class Worker {
+public:
+  Worker(const Options &opts, double rate, const addrinfo *addr,
+         const Url &url, size_t connections, unsigned seed)
+      : opts_(opts), addr_(addr), url_(url), rng_(seed),
+        conns_(connections) {
+    if (!conns_.empty())
+      conns_.front().observer = true;
+    ack_mode_ = opts.mode == "ack";
+    if (rate > 0)
+      interval_ = std::chrono::duration_cast<clock_type::duration>(
+          std::chrono::duration<double>(
+              static_cast<double>(opts.threads) / rate));
+  }
+
+  void run() {
+    // Ramp up gradually so the server's accept queue does not overflow, and
+    // only start the clock once every connection is up or has failed.
+    auto give_up = clock_type::now() + std::chrono::seconds(10);
+    for (size_t started = 0; clock_type::now() < give_up;) {
+      for (size_t i = 0; i < 64 && started < conns_.size(); ++i)
+        open(conns_[started++]);
+      if (started == conns_.size() && !connecting())
+        break;
+      poll_once();
+    }
+    auto start = clock_type::now();
+    auto stop_sending =
+        start + std::chrono::duration_cast<clock_type::duration>(
+                    std::chrono::duration<double>(opts_.duration));
+    start_ = start;
+    auto deadline = stop_sending + std::chrono::seconds(2); // drain answers
+    next_send_ = start;
+    for (auto now = start; now < deadline; now = clock_type::now()) {
+      if (now < stop_sending || replay_next_ < replay_.size())
+        send_due(now);
+      else if (outstanding() == 0)
+        break;
+      poll_once();
+    }
+    for (auto &conn : conns_) {
+      abandon(conn, deadline);
+      if (conn.fd >= 0)
+        close(conn.fd);
+    }
+  }
+
+  // Switches from random placements to these, sent at their recorded time.
+  void replay(std::vector<RecordedPlacement> records) {
+    replay_ = std::move(records);
+    replaying_ = true;
+  }
+
+  Stats &stats() { return stats_; }
+
+private:
+  bool connecting() const {
+    return std::any_of(conns_.begin(), conns_.end(), [](const auto &conn) {
+      return conn.state == ConnState::connecting ||
+             conn.state == ConnState::upgrading;
+    });
+  }
+
+  void poll_once() {
+    fds_.clear();
+    for (auto &conn : conns_) {
+      short events = 0;
+      if (conn.state == ConnState::connecting ||
+          conn.out_offset < conn.out.size())
+        events |= POLLOUT;
+      if (conn.state == ConnState::upgrading || conn.state == ConnState::open)
+        events |= POLLIN;
+      fds_.push_back(pollfd{conn.fd, events, 0});
+    }
+    poll(fds_.data(), fds_.size(), 1);
+    for (size_t i = 0; i < conns_.size(); ++i) {
+      auto &conn = conns_[i];
+      if (conn.fd < 0 || fds_[i].revents == 0)
+        continue;
+      if (fds_[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        fail(conn);
+        continue;
+      }
+      if (fds_[i].revents & POLLOUT) {
+        if (conn.state == ConnState::connecting)
+          upgrade(conn);
+        if (conn.fd >= 0)
+          flush(conn);
+      }
+      if (conn.fd >= 0 && (fds_[i].revents & POLLIN))
+        receive(conn);
+    }
+  }
+
+  void open(Connection &conn) {
+    conn.fd = socket(addr_->ai_family, SOCK_STREAM, 0);
+    if (conn.fd < 0) {
+      ++stats_.failed;
+      conn.state = ConnState::closed;
+      return;
+    }
+    fcntl(conn.fd, F_SETFL, O_NONBLOCK);
+    int on = 1;
+    setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+#ifdef SO_NOSIGPIPE
+    setsockopt(conn.fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    if (connect(conn.fd, addr_->ai_addr, addr_->ai_addrlen) != 0 &&
+        errno != EINPROGRESS) {
+      fail(conn);
+      return;
+    }
+    conn.state = ConnState::connecting;
+  }
+
+  void fail(Connection &conn) {
+    if (conn.state == ConnState::open)
+      ++stats_.closed;
+    else if (conn.state != ConnState::closed)
+      ++stats_.failed;
+    if (conn.fd >= 0)
+      close(conn.fd);
+    conn.fd = -1;
+    conn.state = ConnState::closed;
+    abandon(conn, clock_type::now());
+  }
+
+  // Counts every placement still waiting on `conn` as answered at `now`.
+  // Dropping them instead would hide exactly the slowest placements from
+  // the latency histograms, so a stalled server would look fast.
+  void abandon(Connection &conn, clock_type::time_point now) {
+    auto record = [this, now](const SendTime &sent) {
+      ++stats_.unanswered;
+      stats_.latency->record(nanos_until(sent.intended, now));
+      stats_.service->record(nanos_until(sent.actual, now));
+    };
+    for (auto &entry : conn.in_flight)
+      record(entry.second);
+    for (auto &echo : conn.echoes)
+      record(echo.sent);
+    conn.in_flight.clear();
+    conn.echoes.clear();
+  }
+
+  static uint64_t nanos_until(clock_type::time_point from,
+                              clock_type::time_point to) {
+    return static_cast<uint64_t>(std::max<int64_t>(
+        0, std::chrono::duration_cast<std::chrono::nanoseconds>(to - from)
+               .count()));
+  }
+
+  void upgrade(Connection &conn) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0) {
+      fail(conn);
+      return;
+    }
+    conn.state = ConnState::upgrading;
+    conn.out += "GET " + url_.target + " HTTP/1.1\r\nHost: " + url_.host +
+                ':' + url_.port +
+                "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                "Sec-WebSocket-Version: 13\r\n\r\n";
+  }
+
+  void flush(Connection &conn) {
+    while (conn.out_offset < conn.out.size()) {
+      auto n = send(conn.fd, conn.out.data() + conn.out_offset,
+                    conn.out.size() - conn.out_offset, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          fail(conn);
+        return;
+      }
+      conn.out_offset += static_cast<size_t>(n);
+    }
+    conn.out.clear();
+    conn.out_offset = 0;
+  }
+
+  // Appends a masked client frame.
+  void write_frame(Connection &conn, uint8_t opcode, std::string_view data) {
+    auto &out = conn.out;
+    out += static_cast<char>(0x80 | opcode);
+    if (data.size() < 126) {
+      out += static_cast<char>(0x80 | data.size());
+    } else {
+      out += static_cast<char>(0x80 | 126);
+      out += static_cast<char>((data.size() >> 8) & 0xFF);
+      out += static_cast<char>(data.size() & 0xFF);
+    }
+    uint32_t mask = rng_();
+    char key[4];
+    std::memcpy(key, &mask, 4);
+    out.append(key, 4);
+    for (size_t i = 0; i < data.size(); ++i)
+      out += static_cast<char>(data[i] ^ key[i % 4]);
+  }
+
+  bool can_send(const Connection &conn) const {
+    if (conn.state != ConnState::open)
+      return false;
+    if (ack_mode_)
+      return conn.in_flight.size() < opts_.window;
+    return conn.echoes.empty();
+  }
+
+  void send_due(clock_type::time_point now) {
+    if (replaying_) {
+      replay_due(now);
+      return;
+    }
+    if (interval_.count() == 0) {
+      // Unthrottled: fill every window.
+      for (auto &conn : conns_)
+        while (can_send(conn))
+          send_placement(conn, now, now);
+      return;
+    }
+    while (next_send_ <= now) {
+      if (opts_.open_loop) {
+        // Open loop: every slot is sent, however late, and keeps its
+        // intended time. Only a thread without any open connection skips.
+        auto *conn = next_open();
+        if (conn == nullptr) {
+          ++stats_.missed;
+        } else {
+          auto lag = std::chrono::duration_cast<std::chrono::nanoseconds>(
+              now - next_send_);
+          stats_.max_lag_ns = std::max(stats_.max_lag_ns,
+                                       static_cast<uint64_t>(lag.count()));
+          send_placement(*conn, next_send_, now);
+        }
+      } else if (auto *conn = next_ready()) {
+        send_placement(*conn, now, now);
+      } else {
+        // Closed loop: a slot nobody could take is lost, not queued.
+        ++stats_.missed;
+      }
+      next_send_ += interval_;
+    }
+  }
+
+  void replay_due(clock_type::time_point now) {
+    if (conns_.empty()) {
+      stats_.missed += replay_.size() - replay_next_;
+      replay_next_ = replay_.size();
+      return;
+    }
+    for (; replay_next_ < replay_.size(); ++replay_next_) {
+      auto &rec = replay_[replay_next_];
+      auto intended =
+          start_ + std::chrono::duration_cast<clock_type::duration>(
+                       std::chrono::duration<double, std::micro>(
+                           static_cast<double>(rec.time_us) / opts_.speed));
+      if (intended > now)
+        return;
+      auto &conn = conns_[(rec.session / opts_.threads) % conns_.size()];
+      if (conn.state != ConnState::open) {
+        ++stats_.missed;
+        continue;
+      }
+      auto lag =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(now - intended);
+      stats_.max_lag_ns =
+          std::max(stats_.max_lag_ns, static_cast<uint64_t>(lag.count()));
+      send_pixel(conn, Pixel{rec.x, rec.y, rec.color}, intended, now);
+    }
+  }
+
+  Connection *next_open() {
+    for (size_t i = 0; i < conns_.size(); ++i) {
+      auto &conn = conns_[cursor_++ % conns_.size()];
+      if (conn.state == ConnState::open)
+        return &conn;
+    }
+    return nullptr;
+  }
+
+  Connection *next_ready() {
+    for (size_t i = 0; i < conns_.size(); ++i) {
+      auto &conn = conns_[cursor_++ % conns_.size()];
+      if (can_send(conn))
+        return &conn;
+    }
+    return nullptr;
+  }
+
+  void send_placement(Connection &conn, clock_type::time_point intended,
+                      clock_type::time_point now) {
+    std::uniform_int_distribution<int> coord(0, DIM - 1);
+    std::uniform_int_distribution<int> color(0, 0xFFFFFF);
+    auto x = coord(rng_);
+    auto y = coord(rng_);
+    send_pixel(conn, Pixel{x, y, color(rng_)}, intended, now);
+  }
+
+  void send_pixel(Connection &conn, const Pixel &px,
+                  clock_type::time_point intended, clock_type::time_point now) {
+    auto [x, y, c] = px;
+    std::string text = "{\"x\":" + std::to_string(x) +
+                       ",\"y\":" + std::to_string(y) +
+                       ",\"color\":" + std::to_string(c);
+    if (ack_mode_) {
+      auto seq = conn.next_seq++;
+      text += ",\"seq\":" + std::to_string(seq);
+      conn.in_flight.emplace(seq, SendTime{intended, now});
+    } else {
+      conn.echoes.push_back(Echo{SendTime{intended, now}, px});
+    }
+    text += '}';
+    write_frame(conn, 0x1, text);
+    flush(conn);
+    pending_visible_[pixel_key(x, y, c)] = intended;
+    ++stats_.sent;
+  }
+
+  size_t outstanding() const {
+    size_t n = 0;
+    for (auto &conn : conns_)
+      n += conn.in_flight.size() + conn.echoes.size();
+    return n;
+  }
+
+  void receive(Connection &conn) {
+    char buf[16384];
+    for (;;) {
+      auto n = recv(conn.fd, buf, sizeof(buf), 0);
+      if (n == 0) {
+        fail(conn);
+        return;
+      }
+      if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          fail(conn);
+        break;
+      }
+      conn.in.append(buf, static_cast<size_t>(n));
+    }
+    if (conn.state == ConnState::upgrading) {
+      auto end = conn.in.find("\r\n\r\n");
+      if (end == std::string::npos)
+        return;
+      if (conn.in.compare(0, 12, "HTTP/1.1 101") != 0) {
+        fail(conn);
+        return;
+      }
+      conn.in.erase(0, end + 4);
+      conn.state = ConnState::open;
+      ++stats_.connected;
+    }
+    size_t pos = 0;
+    while (conn.fd >= 0) {
+      // Server frames are never masked.
+      auto avail = conn.in.size() - pos;
+      if (avail < 2)
+        break;
+      auto *p = reinterpret_cast<const uint8_t *>(conn.in.data() + pos);
+      auto opcode = p[0] & 0x0F;
+      uint64_t len = p[1] & 0x7F;
+      size_t header = 2;
+      if (len == 126) {
+        if (avail < 4)
+          break;
+        len = (uint64_t{p[2]} << 8) | p[3];
+        header = 4;
+      } else if (len == 127) {
+        if (avail < 10)
+          break;
+        len = 0;
+        for (int i = 0; i < 8; ++i)
+          len = (len << 8) | p[2 + i];
+        header = 10;
+      }
+      if (avail < header + len)
+        break;
+      std::string_view payload{conn.in.data() + pos + header,
+                               static_cast<size_t>(len)};
+      pos += header + static_cast<size_t>(len);
+      handle_frame(conn, opcode, payload);
+    }
+    conn.in.erase(0, pos);
+  }
+
+  void handle_frame(Connection &conn, int opcode, std::string_view payload) {
+    auto now = clock_type::now();
+    switch (opcode) {
+      case 0x1:
+        handle_text(conn, payload, now);
+        break;
+      case 0x2:
+        if (payload.substr(0, 4) == "RPSN")
+          ++stats_.snapshots;
+        break;
+      case 0x8:
+        fail(conn);
+        break;
+      case 0x9:
+        write_frame(conn, 0xA, payload);
+        flush(conn);
+        break;
+      default:
+        break;
+    }
+  }
+
+  void handle_text(Connection &conn, std::string_view text,
+                   clock_type::time_point now) {
+    auto starts_with = [&](std::string_view prefix) {
+      return text.substr(0, prefix.size()) == prefix;
+    };
+    if (starts_with(R"({"type":"batch",)")) {
+      if (conn.observer)
+        handle_batch(conn, text, now);
+      return;
+    }
+    if (starts_with(R"({"type":"ack",)")) {
+      // {"type":"ack","acks":[[seq,status(,retry_ms)],...]}
+      size_t pos = text.find('[');
+      while ((pos = text.find('[', pos + 1)) != std::string_view::npos) {
+        uint64_t seq = 0;
+        uint64_t status = 0;
+        if (!next_number(text, pos, seq) || !next_number(text, pos, status))
+          break;
+        auto i = conn.in_flight.find(seq);
+        if (i == conn.in_flight.end()) {
+          ++stats_.unexpected;
+          continue;
+        }
+        record_answer(i->second, now, status);
+        conn.in_flight.erase(i);
+      }
+      return;
+    }
+    if (starts_with(R"({"x":)")) {
+      if (conn.echoes.empty()) {
+        ++stats_.unexpected;
+        return;
+      }
+      // Echoes come back in order, so anything but the oldest placement is
+      // a wrong or reordered echo and does not count as answered.
+      auto &echo = conn.echoes.front();
+      auto px = echoed(text);
+      if (px.x == echo.px.x && px.y == echo.px.y && px.color == echo.px.color)
+        record_answer(echo.sent, now, 0);
+      else
+        ++stats_.mismatched;
+      conn.echoes.pop_front();
+      return;
+    }
+    // busy, cooldown or rate_limited in echo mode take the echo's place.
+    ++stats_.notices;
+    if (!ack_mode_ && !conn.echoes.empty()) {
+      conn.echoes.pop_front();
+      ++stats_.answered;
+    }
+  }
+
+  // The pixel of an echoed {"x":1,"y":2,"color":3}, {-1, -1, -1} if garbled.
+  static Pixel echoed(std::string_view text) {
+    Pixel px{-1, -1, -1};
+    auto field = [text](std::string_view key, int32_t &out) {
+      auto pos = text.find(key);
+      if (pos == std::string_view::npos)
+        return;
+      pos += key.size();
+      uint64_t value = 0;
+      if (next_number(text, pos, value) && value <= INT32_MAX)
+        out = static_cast<int32_t>(value);
+    };
+    field(R"("x":)", px.x);
+    field(R"("y":)", px.y);
+    field(R"("color":)", px.color);
+    return px;
+  }
+
+  void record_answer(const SendTime &sent, clock_type::time_point now,
+                     uint64_t status) {
+    ++stats_.answered;
+    ++stats_.statuses[std::min<uint64_t>(status, 5)];
+    stats_.latency->record(nanos_until(sent.intended, now));
+    stats_.service->record(nanos_until(sent.actual, now));
+  }
+
+  // {"type":"batch","seq":N,"pixels":[[x,y,color],...]}
+  void handle_batch(Connection &conn, std::string_view text,
+                    clock_type::time_point now) {
+    ++stats_.batches;
+    size_t pos = text.find("\"seq\":");
+    uint64_t seq = 0;
+    if (pos == std::string_view::npos || !next_number(text, pos, seq))
+      return;
+    if (conn.last_batch != 0 && seq > conn.last_batch + 1)
+      stats_.gaps += seq - conn.last_batch - 1;
+    conn.last_batch = seq;
+    pos = text.find('[', pos);
+    uint64_t x = 0;
+    uint64_t y = 0;
+    uint64_t c = 0;
+    while (next_number(text, pos, x) && next_number(text, pos, y) &&
+           next_number(text, pos, c)) {
+      auto i = pending_visible_.find(pixel_key(x, y, c));
+      if (i == pending_visible_.end())
+        continue;
+      ++stats_.visible;
+      stats_.visibility->record(static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(now - i->second)
+              .count()));
+      pending_visible_.erase(i);
+    }
+    // Forget placements that never showed up, e.g. rejected ones.
+    if (pending_visible_.size() > 1'000'000)
+      pending_visible_.clear();
+  }
+
+  const Options &opts_;
+  const addrinfo *addr_;
+  const Url &url_;
+  std::mt19937 rng_;
+  std::vector<Connection> conns_;
+  bool ack_mode_ = true;
+  clock_type::duration interval_{0};
+  clock_type::time_point next_send_;
+  size_t cursor_ = 0;
+  clock_type::time_point start_;
+  bool replaying_ = false;
+  std::vector<RecordedPlacement> replay_;
+  size_t replay_next_ = 0;
+  std::vector<pollfd> fds_;
+  std::unordered_map<uint64_t, clock_type::time_point> pending_visible_;
+  Stats stats_;
+};
+
+// std::stoul and std::stod, but without trailing garbage or a sign that
+// stoul would wrap around. Throw std::invalid_argument or std::out_of_range.
+size_t parse_count(const std::string &value) {
+  size_t end = 0;
+  auto result = std::stoul(value, &end);
+  if (end != value.size() || value.find('-') != std::string::npos)
+    throw std::invalid_argument{value};
+  return result;
+}
+
+double parse_double(const std::string &value) {
+  size_t end = 0;
+  auto result = std::stod(value, &end);
+  if (end != value.size())
+    throw std::invalid_argument{value};
+  return result;
+}
+
+std::vector<double> parse_rates(const std::string &list) {
+  std::vector<double> result;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    auto end = std::min(list.find(',', pos), list.size());
+    result.push_back(parse_double(list.substr(pos, end - pos)));
+    pos = end + 1;
+  }
+  return result;
+}
+
+bool parse_args(int argc, char **argv, Options &opts) {
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg == "--open-loop") {
+      opts.open_loop = true;
+      continue;
+    }
+    if (arg == "--json") {
+      opts.json = true;
+      continue;
+    }
+    std::string value;
+    if (auto eq = arg.find('='); eq != std::string_view::npos) {
+      value = arg.substr(eq + 1);
+      arg = arg.substr(0, eq);
+    } else if (i + 1 < argc) {
+      value = argv[++i];
+    } else {
+      return false;
+    }
+    // A malformed number is a usage error like an unknown option.
+    try {
+      if (arg == "--url")
+        opts.url = value;
+      else if (arg == "--connections")
+        opts.connections = parse_count(value);
+      else if (arg == "--threads")
+        opts.threads = std::max<size_t>(parse_count(value), 1);
+      else if (arg == "--rate")
+        opts.rate = parse_double(value);
+      else if (arg == "--duration")
+        opts.duration = parse_double(value);
+      else if (arg == "--mode")
+        opts.mode = value;
+      else if (arg == "--window")
+        opts.window = std::max<size_t>(parse_count(value), 1);
+      else if (arg == "--sweep")
+        opts.sweep = parse_rates(value);
+      else if (arg == "--replay")
+        opts.replay = value;
+      else if (arg == "--speed")
+        opts.speed = parse_double(value);
+      else
+        return false;
+    } catch (const std::logic_error &) {
+      std::cerr << "*** invalid value for " << arg << ": " << value << '\n';
+      return false;
+    }
+  }
+  // A sweep or a replay is only meaningful open-loop, and open loop needs a
+  // rate unless the trace provides the timing.
+  if (!opts.sweep.empty() || !opts.replay.empty())
+    opts.open_loop = true;
+  if (opts.open_loop && opts.sweep.empty() && opts.replay.empty() &&
+      opts.rate <= 0)
+    return false;
+  if (opts.speed <= 0 || (!opts.replay.empty() && !opts.sweep.empty()))
+    return false;
+  return opts.mode == "ack" || opts.mode == "echo";
+}
+
+// Everything one run at one offered rate measured, over all threads.
+struct Totals {
+  Stats stats;
+  LatencyHistogram::Snapshot latency;
+  LatencyHistogram::Snapshot service;
+  LatencyHistogram::Snapshot visibility;
+};
+
+// Splits a trace by session over the threads.
+bool load_replay(Options &opts,
+                 std::vector<std::vector<RecordedPlacement>> &out) {
+  RecordingReader reader;
+  if (!reader.open(opts.replay))
+    return false;
+  out.assign(opts.threads, {});
+  RecordedPlacement rec;
+  uint64_t last = 0;
+  while (reader.next(rec)) {
+    out[rec.session % opts.threads].push_back(rec);
+    last = rec.time_us;
+  }
+  opts.duration = std::max(last / 1e6 / opts.speed, 1e-3);
+  return true;
+}
+
+Totals run_step(const Options &opts, double rate, const addrinfo *addr,
+                const Url &url,
+                std::vector<std::vector<RecordedPlacement>> replay = {}) {
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (size_t i = 0; i < opts.threads; ++i) {
+    auto share = opts.connections / opts.threads +
+                 (i < opts.connections % opts.threads ? 1 : 0);
+    workers.push_back(std::make_unique<Worker>(
+        opts, rate, addr, url, share, static_cast<unsigned>(i + 1)));
+    if (!replay.empty())
+      workers.back()->replay(std::move(replay[i]));
+  }
+  std::vector<std::thread> threads;
+  for (auto &worker : workers)
+    threads.emplace_back([&worker] { worker->run(); });
+  for (auto &thread : threads)
+    thread.join();
+  Totals result;
+  auto &total = result.stats;
+  for (auto &worker : workers) {
+    auto &st = worker->stats();
+    total.connected += st.connected;
+    total.failed += st.failed;
+    total.closed += st.closed;
+    total.sent += st.sent;
+    total.missed += st.missed;
+    total.max_lag_ns = std::max(total.max_lag_ns, st.max_lag_ns);
+    total.answered += st.answered;
+    total.unanswered += st.unanswered;
+    for (int i = 0; i < 6; ++i)
+      total.statuses[i] += st.statuses[i];
+    total.unexpected += st.unexpected;
+    total.mismatched += st.mismatched;
+    total.notices += st.notices;
+    total.batches += st.batches;
+    total.gaps += st.gaps;
+    total.snapshots += st.snapshots;
+    total.visible += st.visible;
+    st.latency->merge_into(result.latency);
+    st.service->merge_into(result.service);
+    st.visibility->merge_into(result.visibility);
+  }
+  return result;
+}
+
+void print_latency(const char *what, const LatencyHistogram::Snapshot &hist) {
+  std::printf("%-12s p50 %9.1f  p90 %9.1f  p99 %9.1f  p999 %9.1f  max %9.1f"
+              " (us)\n",
+              what, hist.quantile(0.5) / 1e3, hist.quantile(0.9) / 1e3,
+              hist.quantile(0.99) / 1e3, hist.quantile(0.999) / 1e3,
+              hist.max / 1e3);
+}
+
+void print_report(const Options &opts, const Totals &result) {
+  auto &total = result.stats;
+  std::printf("connections  %llu open, %llu failed, %llu closed by server\n",
+              static_cast<unsigned long long>(total.connected),
+              static_cast<unsigned long long>(total.failed),
+              static_cast<unsigned long long>(total.closed));
+  std::printf("sent         %llu (%.1f/s), %llu send slots missed\n",
+              static_cast<unsigned long long>(total.sent),
+              total.sent / opts.duration,
+              static_cast<unsigned long long>(total.missed));
+  std::printf("answered     %llu: ok %llu, out of bounds %llu, invalid %llu,"
+              " failed %llu, cooldown %llu, busy %llu\n",
+              static_cast<unsigned long long>(total.answered),
+              static_cast<unsigned long long>(total.statuses[0]),
+              static_cast<unsigned long long>(total.statuses[1]),
+              static_cast<unsigned long long>(total.statuses[2]),
+              static_cast<unsigned long long>(total.statuses[3]),
+              static_cast<unsigned long long>(total.statuses[4]),
+              static_cast<unsigned long long>(total.statuses[5]));
+  std::printf("             %llu unexpected, %llu mismatched echoes, %llu "
+              "notices, %llu unanswered (in latency as of the deadline)\n",
+              static_cast<unsigned long long>(total.unexpected),
+              static_cast<unsigned long long>(total.mismatched),
+              static_cast<unsigned long long>(total.notices),
+              static_cast<unsigned long long>(total.unanswered));
+  print_latency("latency", result.latency);
+  if (opts.open_loop) {
+    print_latency("uncorrected", result.service);
+    std::printf("sender lag   max %.1f us\n", total.max_lag_ns / 1e3);
+  }
+  std::printf("batches      %llu seen, %llu missed, %llu snapshots, "
+              "%llu placements visible\n",
+              static_cast<unsigned long long>(total.batches),
+              static_cast<unsigned long long>(total.gaps),
+              static_cast<unsigned long long>(total.snapshots),
+              static_cast<unsigned long long>(total.visible));
+  print_latency("visible", result.visibility);
+}
+
+// Same numbers as print_report, latencies in microseconds.
+void print_json(const Options &opts, double rate, const Totals &result) {
+  auto &total = result.stats;
+  auto quantiles = [](const LatencyHistogram::Snapshot &hist) {
+    char buf[160];
+    std::snprintf(buf, sizeof(buf),
+                  "{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,"
+                  "\"p999\":%.1f,\"max\":%.1f}",
+                  hist.quantile(0.5) / 1e3, hist.quantile(0.9) / 1e3,
+                  hist.quantile(0.99) / 1e3, hist.quantile(0.999) / 1e3,
+                  hist.max / 1e3);
+    return std::string{buf};
+  };
+  std::printf("{\"offered\":%.1f,\"open_loop\":%s,\"connections\":%llu,"
+              "\"failed\":%llu,\"sent\":%llu,\"answered\":%llu,"
+              "\"unanswered\":%llu,\"mismatched\":%llu,\"ok\":%llu,"
+              "\"missed\":%llu,"
+              "\"achieved\":%.1f,"
+              "\"latency_us\":%s,\"uncorrected_us\":%s,"
+              "\"visible_us\":%s}\n",
+              rate, opts.open_loop ? "true" : "false",
+              static_cast<unsigned long long>(total.connected),
+              static_cast<unsigned long long>(total.failed),
+              static_cast<unsigned long long>(total.sent),
+              static_cast<unsigned long long>(total.answered),
+              static_cast<unsigned long long>(total.unanswered),
+              static_cast<unsigned long long>(total.mismatched),
+              static_cast<unsigned long long>(total.statuses[0]),
+              static_cast<unsigned long long>(total.missed),
+              total.answered / opts.duration,
+              quantiles(result.latency).c_str(),
+              quantiles(result.service).c_str(),
+              quantiles(result.visibility).c_str());
+  std::fflush(stdout);
+}
+
+// One row per offered rate. Corrected quantiles in microseconds, including
+// placements left unanswered at the deadline; a server past saturation shows
+// up as achieved < offered and exploding quantiles.
+void print_sweep_row(const Options &opts, double rate, const Totals &result) {
+  auto &total = result.stats;
+  auto &hist = result.latency;
+  std::printf("%10.0f %10.0f %8llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+              rate, total.answered / opts.duration,
+              static_cast<unsigned long long>(total.sent - total.answered),
+              hist.quantile(0.5) / 1e3, hist.quantile(0.9) / 1e3,
+              hist.quantile(0.99) / 1e3, hist.quantile(0.999) / 1e3,
+              hist.max / 1e3, result.service.quantile(0.99) / 1e3);
+  std::fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!parse_args(argc, argv, opts)) {
+    std::cerr << "usage: loadgen [--url ws://host:port/path] [--connections N]"
+                 " [--threads N]\n               [--rate PER_SEC] "
+                 "[--duration SEC] [--mode ack|echo] [--window N]\n"
+                 "               [--open-loop] [--sweep RATE,RATE,...]\n"
+                 "               [--replay FILE] [--speed FACTOR] [--json]\n";
+    return EXIT_FAILURE;
+  }
+  Url url;
+  if (!parse_url(opts.url, url)) {
+    std::cerr << "*** invalid url: " << opts.url << '\n';
+    return EXIT_FAILURE;
+  }
+  addrinfo hints{};
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addr = nullptr;
+  if (auto err = getaddrinfo(url.host.c_str(), url.port.c_str(), &hints, &addr);
+      err != 0) {
+    std::cerr << "*** cannot resolve " << url.host << ": "
+              << gai_strerror(err) << '\n';
+    return EXIT_FAILURE;
+  }
+  if (opts.sweep.empty()) {
+    std::vector<std::vector<RecordedPlacement>> replay;
+    if (!opts.replay.empty() && !load_replay(opts, replay)) {
+      std::cerr << "*** cannot read trace " << opts.replay << '\n';
+      freeaddrinfo(addr);
+      return EXIT_FAILURE;
+    }
+    auto result = run_step(opts, opts.rate, addr, url, std::move(replay));
+    freeaddrinfo(addr);
+    if (opts.json)
+      print_json(opts, opts.rate, result);
+    else
+      print_report(opts, result);
+    return result.stats.connected > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (!opts.json)
+    std::printf("%10s %10s %8s %10s %10s %10s %10s %10s %10s\n", "offered",
+                "achieved", "lost", "p50_us", "p90_us", "p99_us", "p999_us",
+                "max_us", "p99_uncorr");
+  uint64_t connected = 0;
+  for (auto rate : opts.sweep) {
+    auto result = run_step(opts, rate, addr, url);
+    connected += result.stats.connected;
+    if (opts.json)
+      print_json(opts, rate, result);
+    else
+      print_sweep_row(opts, rate, result);
+    // Let the server drain and close the previous step's connections.
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+  }
+  freeaddrinfo(addr);
+  return connected > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
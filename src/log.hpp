@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Levels below this are compiled out entirely. Build with
+// -DRPLACE_MIN_LOG_LEVEL=0 to get debug output, e.g. every parsed frame.
+#ifndef RPLACE_MIN_LOG_LEVEL
+#define RPLACE_MIN_LOG_LEVEL 1
+#endif
+
+enum class LogLevel : int { debug = 0, info = 1, warn = 2, error = 3 };
+
+// One formatted line. Longer lines are truncated.
+struct LogRecord {
+  std::chrono::system_clock::time_point time;
+  LogLevel level;
+  uint16_t size;
+  char text[236];
+};
+
+// Structured, levelled logging without locks on the calling thread:
+//
+//   RPLACE_LOG(info, "session fell behind", "id", id, "queued", n);
+//
+// prints "<time> INFO session fell behind id=12 queued=64". Every thread
+// formats into its own single-producer ring of fixed-size records, and a
+// background thread drains all rings to stdout. A full ring drops the line
+// and counts it instead of blocking the caller.
+class Logger {
+public:
+  static constexpr size_t ring_size = 1024; // records per thread
+
+  Logger() : thread_([this] { run(); }) {}
+
+  Logger(const Logger &) = delete;
+  Logger &operator=(const Logger &) = delete;
+
+  ~Logger() {
+    {
+      std::lock_guard<std::mutex> guard{mtx_};
+      running_ = false;
+    }
+    cv_.notify_one();
+    thread_.join();
+    drain();
+  }
+
+  bool enabled(LogLevel level) const {
+    return static_cast<int>(level) >= level_.load(std::memory_order_relaxed);
+  }
+
+  void set_level(LogLevel level) {
+    level_.store(static_cast<int>(level), std::memory_order_relaxed);
+  }
+
+  template <class... Fields>
+  void write(LogLevel level, std::string_view msg, const Fields &...fields) {
+    static_assert(sizeof...(Fields) % 2 == 0, "fields come as key, value");
+    auto &ring = local();
+    auto tail = ring.tail.load(std::memory_order_relaxed);
+    if (tail - ring.head.load(std::memory_order_acquire) == ring_size) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    auto &rec = ring.records[tail % ring_size];
+    rec.time = std::chrono::system_clock::now();
+    rec.level = level;
+    Writer out{rec.text, sizeof(rec.text)};
+    out.append(msg);
+    append_fields(out, fields...);
+    rec.size = static_cast<uint16_t>(out.size);
+    ring.tail.store(tail + 1, std::memory_order_release);
+  }
+
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  struct Ring {
+    alignas(64) std::atomic<uint64_t> head{0}; // next record to drain
+    alignas(64) std::atomic<uint64_t> tail{0}; // next record to write
+    std::array<LogRecord, ring_size> records;
+  };
+
+  struct Writer {
+    char *buf;
+    size_t capacity;
+    size_t size = 0;
+
+    void append(std::string_view str) {
+      auto n = std::min(str.size(), capacity - size);
+      std::memcpy(buf + size, str.data(), n);
+      size += n;
+    }
+
+    template <class T> void append_value(const T &value) {
+      if constexpr (std::is_same_v<T, bool>) {
+        append(value ? "true" : "false");
+      } else if constexpr (std::is_integral_v<T>) {
+        char tmp[24];
+        auto res = std::to_chars(tmp, tmp + sizeof(tmp), value);
+        append(std::string_view{tmp, static_cast<size_t>(res.ptr - tmp)});
+      } else if constexpr (std::is_floating_point_v<T>) {
+        char tmp[32];
+        auto n = std::snprintf(tmp, sizeof(tmp), "%g",
+                               static_cast<double>(value));
+        append(std::string_view{tmp, static_cast<size_t>(std::max(n, 0))});
+      } else {
+        append(std::string_view{value});
+      }
+    }
+  };
+
+  static void append_fields(Writer &) {
+    // nop
+  }
+
+  template <class Key, class Value, class... Fields>
+  static void append_fields(Writer &out, const Key &key, const Value &value,
+                            const Fields &...fields) {
+    out.append(" ");
+    out.append(key);
+    out.append("=");
+    out.append_value(value);
+    append_fields(out, fields...);
+  }
+
+  Ring &local() {
+    thread_local Ring *ring = nullptr;
+    if (ring == nullptr) {
+      std::lock_guard<std::mutex> guard{rings_mtx_};
+      rings_.push_back(std::make_unique<Ring>());
+      ring = rings_.back().get();
+    }
+    return *ring;
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> guard{mtx_};
+    while (running_) {
+      guard.unlock();
+      drain();
+      guard.lock();
+      cv_.wait_for(guard, std::chrono::milliseconds(20));
+    }
+  }
+
+  // Formats everything queued so far and writes it with one fwrite.
+  void drain() {
+    std::vector<Ring *> rings;
+    {
+      std::lock_guard<std::mutex> guard{rings_mtx_};
+      for (auto &ring : rings_)
+        rings.push_back(ring.get());
+    }
+    out_.clear();
+    for (auto *ring : rings) {
+      auto head = ring->head.load(std::memory_order_relaxed);
+      auto tail = ring->tail.load(std::memory_order_acquire);
+      for (; head != tail; ++head)
+        format(ring->records[head % ring_size]);
+      ring->head.store(head, std::memory_order_release);
+    }
+    if (auto n = dropped_.load(std::memory_order_relaxed); n != reported_) {
+      out_ += "*** log: dropped " + std::to_string(n - reported_) +
+              " lines\n";
+      reported_ = n;
+    }
+    if (!out_.empty()) {
+      std::fwrite(out_.data(), 1, out_.size(), stdout);
+      std::fflush(stdout);
+    }
+  }
+
+  void format(const LogRecord &rec) {
+    static constexpr const char *names[] = {"DEBUG", "INFO ", "WARN ",
+                                            "ERROR"};
+    using namespace std::chrono;
+    auto since_epoch = rec.time.time_since_epoch();
+    auto secs = duration_cast<seconds>(since_epoch);
+    auto millis = duration_cast<milliseconds>(since_epoch - secs).count();
+    auto t = static_cast<std::time_t>(secs.count());
+    std::tm tm{};
+    gmtime_r(&t, &tm);
+    char stamp[96];
+    std::snprintf(stamp, sizeof(stamp), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ ",
+                  tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+                  tm.tm_min, tm.tm_sec, static_cast<int>(millis));
+    out_ += stamp;
+    out_ += names[static_cast<int>(rec.level)];
+    out_ += ' ';
+    out_.append(rec.text, rec.size);
+    out_ += '\n';
+  }
+
+  std::atomic<int> level_{RPLACE_MIN_LOG_LEVEL};
+  std::atomic<uint64_t> dropped_{0};
+  uint64_t reported_ = 0; // only touched by drain()
+  std::string out_;       // only touched by drain()
+  std::mutex rings_mtx_;
+  std::vector<std::unique_ptr<Ring>> rings_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  bool running_ = true;
+  std::thread thread_; // last, starts after everything above exists
+};
+
+inline Logger &logger() {
+  static Logger instance;
+  return instance;
+}
+
+inline bool parse_log_level(std::string_view str, LogLevel &out) {
+  static constexpr std::pair<std::string_view, LogLevel> levels[] = {
+      {"debug", LogLevel::debug},
+      {"info", LogLevel::info},
+      {"warn", LogLevel::warn},
+      {"error", LogLevel::error},
+  };
+  for (auto &[name, level] : levels) {
+    if (str == name) {
+      out = level;
+      return true;
+    }
+  }
+  return false;
+}
+
+#define RPLACE_LOG(level, ...)                                                 \
+  do {                                                                         \
+    if constexpr (static_cast<int>(LogLevel::level) >= RPLACE_MIN_LOG_LEVEL)   \
+      if (logger().enabled(LogLevel::level))                                   \
+        logger().write(LogLevel::level, __VA_ARGS__);                          \
+  } while (false)
+
+// Logs only every `every`-th occurrence per thread and call site, for events
+// that may repeat at message rate.
+#define RPLACE_LOG_SAMPLED(level, every, ...)                                  \
+  do {                                                                         \
+    if constexpr (static_cast<int>(LogLevel::level) >= RPLACE_MIN_LOG_LEVEL) { \
+      static thread_local uint32_t rplace_log_count_ = 0;                      \
+      if (rplace_log_count_++ % (every) == 0)                                  \
+        RPLACE_LOG(level, __VA_ARGS__);                                        \
+    }                                                                          \
+  } while (false)
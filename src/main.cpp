@@ -1,34 +1,104 @@
 #include "caf/error.hpp"
 #include "caf/error_code.hpp"
 #include "caf/net/web_socket/acceptor.hpp"
+#include "admission.hpp"
+#include "affinity.hpp"
+#include "canvas.hpp"
+#include "cooldown.hpp"
+#include "encoding.hpp"
+#include "introspection.hpp"
+#include "listener.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+#include "protocol.hpp"
+#include "ratelimit.hpp"
+#include "recording.hpp"
+#include "spectators.hpp"
+#include "synthetic.hpp"
+#include "tiles.hpp"
+#include "tracing.hpp"
 #include <algorithm>
-#include <caf/actor_ostream.hpp>
+#include <caf/allowed_unsafe_message_type.hpp>
 #include <caf/actor_system.hpp>
 #include <caf/actor_system_config.hpp>
 #include <caf/event_based_actor.hpp>
 #include <caf/exec_main.hpp>
+#include <caf/flow/item_publisher.hpp>
 #include <caf/function_view.hpp>
 #include <caf/init_global_meta_objects.hpp>
+#include <caf/net/http/with.hpp>
 #include <caf/net/middleman.hpp>
+#include <caf/net/tcp_accept_socket.hpp>
 #include <caf/net/web_socket/with.hpp>
 #include <caf/policy/select_all.hpp>
 #include <caf/scheduled_actor/flow.hpp>
 #include <caf/scoped_actor.hpp>
+#include <caf/spawn_options.hpp>
+#include <caf/telemetry/collector/prometheus.hpp>
+#include <caf/telemetry/importer/process.hpp>
+#include <caf/thread_hook.hpp>
+#include <caf/thread_owner.hpp>
 #include <caf/type_id.hpp>
 #include <caf/typed_actor.hpp>
 #include <caf/typed_event_based_actor.hpp>
+#include <atomic>
 #include <chrono>
+#include <csignal>
 #include <cstdint>
 #include <iostream>
 #include <memory>
-#include <nlohmann/json.hpp>
 #include <random>
+#include <thread>
+#include <unordered_map>
+
+// Broadcast batch shared by all sessions. Both frames are encoded once by the
+// canvas; copying a ws::frame only bumps a reference count.
+struct CanvasBatch {
+  uint64_t seq;
+  caf::net::web_socket::frame text;
+  caf::net::web_socket::frame deflated;
+  std::chrono::steady_clock::time_point applied; // oldest pixel
+};
+using CanvasBatchPtr = std::shared_ptr<const CanvasBatch>;
+
+// Copy of the full board, sent instead of deltas to sessions that fell
+// behind. The canvas only copies the bitmap; connection groups encode it.
+struct CanvasImage {
+  uint64_t seq; // last batch included
+  std::vector<int> bitmap;
+};
+using CanvasImagePtr = std::shared_ptr<const CanvasImage>;
+
+CAF_BEGIN_TYPE_ID_BLOCK(rplace, caf::first_custom_type_id)
+  CAF_ADD_ATOM(rplace, batch_atom)
+  CAF_ADD_TYPE_ID(rplace, (Pixel))
+  CAF_ADD_TYPE_ID(rplace, (std::vector<Pixel>))
+CAF_END_TYPE_ID_BLOCK(rplace)
+
+CAF_ALLOW_UNSAFE_MESSAGE_TYPE(CanvasBatchPtr)
+CAF_ALLOW_UNSAFE_MESSAGE_TYPE(CanvasImagePtr)
 
-#define DIM 1000
 using namespace caf;
+namespace http = caf::net::http;
 namespace ws = caf::net::web_socket;
 using trait = ws::default_trait;
 
+// How often pending canvas deltas are flushed to subscribers.
+constexpr auto batch_interval = std::chrono::milliseconds(50);
+
+// Set by SIGUSR1, the canvas prints the stage latencies on its next tick.
+std::atomic<bool> latency_dump_requested{false};
+
+extern "C" void request_latency_dump(int) { latency_dump_requested = true; }
+
+// Frames a session may have waiting for its connection. Past this limit the
+// session drops deltas and resyncs with a snapshot once it has drained.
+constexpr size_t max_queued_frames = 64;
+
+// Hard cap including echoes and acks, which cannot be dropped like deltas.
+// A client that keeps sending without reading is disconnected here.
+constexpr size_t max_session_frames = 4 * max_queued_frames;
+
 struct CellState {
   int color = 0;
   static constexpr const char *name = "cell";
@@ -45,136 +115,1136 @@ canvas_cell_actor(CanvasCell::stateful_pointer<CellState> self) {
 }
 
 struct MatrixState {
-  std::vector<int> bitmap;
+  Canvas canvas;
+  std::vector<actor> subscribers;
+  uint64_t batch_seq = 0;
+  Deflater deflater;
+  CompressionStats compression;
+  // At most one board copy per batch: it is cached until the next batch goes
+  // out. Pixels applied since then are part of that next batch, so clients
+  // end up with the same board either way.
+  CanvasImagePtr image;
+  std::chrono::steady_clock::time_point oldest_pending;
+  std::shared_ptr<TileCache> tiles;
+  std::shared_ptr<SpectatorHub> spectators;
+  ActorProbePtr probe;
   static constexpr const char *name = "matrix";
 };
 using CanvasMatrix =
-    typed_actor<result<int>(put_atom, int, int, int), // x,y, color
-                result<int>(get_atom, int, int)       // get color at col
+    typed_actor<result<int>(put_atom, int, int, int), // x,y, color -> status
+                result<std::string>(put_atom, std::vector<Pixel>), // statuses
+                result<int>(get_atom, int, int),      // get color at col
+                result<void>(join_atom, actor),       // receive batches
+                result<CanvasImagePtr>(get_atom)      // whole board
                 >;
+
+void publish_batch(CanvasMatrix::stateful_pointer<MatrixState> self) {
+  auto &st = self->state;
+  if (!st.canvas.has_pending())
+    return;
+  auto text = encode_batch(++st.batch_seq, st.canvas.take_pending());
+  std::vector<std::byte> packed;
+  auto start = std::chrono::steady_clock::now();
+  if (!st.deflater.compress(text, packed)) {
+    RPLACE_LOG(error, "compressing batch failed", "seq", st.batch_seq);
+    packed.clear();
+  }
+  st.compression.record(text.size(), packed.size(),
+                        std::chrono::steady_clock::now() - start);
+  auto batch = std::make_shared<const CanvasBatch>(
+      CanvasBatch{st.batch_seq, ws::frame{text}, ws::frame{make_span(packed)},
+                  st.oldest_pending});
+  metrics().add(Counter::batches_published);
+  for (auto &sub : st.subscribers)
+    self->send(sub, batch_atom_v, batch);
+  st.spectators->publish({batch, batch->text.as_text()});
+}
+
+// Hands fresh copies of all changed tiles to the HTTP tile endpoint.
+void publish_tiles(CanvasMatrix::stateful_pointer<MatrixState> self) {
+  auto &st = self->state;
+  for (auto tile : st.canvas.take_dirty_tiles()) {
+    std::vector<int> colors;
+    st.canvas.copy_tile(tile, colors);
+    st.tiles->update(std::make_shared<const Tile>(
+        tile, st.canvas.tile_version(tile), std::move(colors)));
+  }
+}
+
+// Encoding the board takes 25-150 ms, which would stall every placement if
+// the canvas did it, so the canvas only hands out a copy (well under 1 ms).
+CanvasImagePtr
+copy_board(CanvasMatrix::stateful_pointer<MatrixState> self) {
+  auto &st = self->state;
+  if (!st.image || st.image->seq != st.batch_seq)
+    st.image = std::make_shared<const CanvasImage>(
+        CanvasImage{st.batch_seq, st.canvas.bitmap()});
+  return st.image;
+}
+
 CanvasMatrix::behavior_type
-canvas_matrix_actor(CanvasMatrix::stateful_pointer<MatrixState> self) {
-  self->state.bitmap.resize(DIM * DIM);
+canvas_matrix_actor(CanvasMatrix::stateful_pointer<MatrixState> self,
+                    std::shared_ptr<TileCache> tiles,
+                    std::shared_ptr<SpectatorHub> spectators, int cpu) {
+  // Only set for a detached canvas, which runs on a thread of its own.
+  if (cpu >= 0 && !pin_current_thread(cpu))
+    RPLACE_LOG(warn, "pinning the canvas failed", "cpu", cpu);
+  self->state.tiles = std::move(tiles);
+  self->state.spectators = std::move(spectators);
+  self->state.probe = introspection().add(MatrixState::name, self->id());
+  self->set_down_handler([self](const down_msg &msg) {
+    auto &subs = self->state.subscribers;
+    subs.erase(std::remove_if(subs.begin(), subs.end(),
+                              [&](const actor &sub) {
+                                return sub.address() == msg.source;
+                              }),
+               subs.end());
+  });
+  auto ticks = std::make_shared<int64_t>(0);
+  self->make_observable()
+      .interval(batch_interval)
+      .for_each([self, ticks](int64_t) {
+        ActorProbe::Scope scope{*self->state.probe};
+        self->state.probe->sample_mailbox(self->mailbox().size());
+        publish_batch(self);
+        publish_tiles(self);
+        // Report compression every ~10s while there is traffic.
+        auto &stats = self->state.compression;
+        if (++*ticks % (std::chrono::seconds(10) / batch_interval) == 0 &&
+            stats.batches > 0)
+          RPLACE_LOG(info, "deflate", "batches", stats.batches, "ratio",
+                     stats.ratio(), "us_per_batch", stats.cpu_us_per_batch());
+        if (latency_dump_requested.exchange(false)) {
+          auto text = metrics().latency_report();
+          std::string_view report{text};
+          while (!report.empty()) {
+            auto end = std::min(report.find('\n'), report.size());
+            RPLACE_LOG(info, report.substr(0, end));
+            report.remove_prefix(std::min(end + 1, report.size()));
+          }
+        }
+      });
   return {[=](put_atom put, int x, int y, int color) {
-            auto index = x + y * DIM;
-            if (index < DIM * DIM) {
-              self->state.bitmap[index] = color;
-            }
-            return color;
+            ActorProbe::Scope scope{*self->state.probe};
+            if (!self->state.canvas.has_pending())
+              self->state.oldest_pending = std::chrono::steady_clock::now();
+            auto status = self->state.canvas.put(x, y, color);
+            if (status == PlaceStatus::ok)
+              metrics().add(Counter::pixels_applied);
+            return static_cast<int>(status);
+          },
+          [=](put_atom, const std::vector<Pixel> &pixels) {
+            ActorProbe::Scope scope{*self->state.probe};
+            if (!self->state.canvas.has_pending())
+              self->state.oldest_pending = std::chrono::steady_clock::now();
+            auto status = self->state.canvas.put_all(pixels);
+            metrics().add(Counter::pixels_applied,
+                          std::count(status.begin(), status.end(), '0'));
+            return status;
           },
           [=](get_atom get, int x, int y) {
-            auto index = x + y * DIM;
-            if (index < DIM * DIM)
-              ;
-            return self->state.bitmap[index];
+            ActorProbe::Scope scope{*self->state.probe};
+            return self->state.canvas.get(x, y);
+          },
+          [=](join_atom, actor sub) {
+            ActorProbe::Scope scope{*self->state.probe};
+            self->monitor(sub);
+            self->state.subscribers.push_back(std::move(sub));
+          },
+          [=](get_atom) {
+            ActorProbe::Scope scope{*self->state.probe};
+            return copy_board(self);
           }};
 }
 
-struct SimpleMessage {
-  int set_x;
-  int set_y;
-  int color;
+// In-process load for the canvas and broadcast paths, without sockets. Every
+// virtual user has at most one placement in flight, like a client that waits
+// for its echo; when all of them are waiting, due placements are skipped and
+// counted rather than queued. The driver also subscribes to the canvas like a
+// connection group, so batches are built and delivered even with no clients.
+struct SyntheticState {
+  LoadProfile profile;
+  std::optional<PixelPicker> picker;
+  std::mt19937 rng{std::random_device{}()};
+  std::vector<uint32_t> idle_users;
+  std::chrono::steady_clock::time_point started;
+  std::chrono::steady_clock::time_point last_tick;
+  double carry = 0; // fraction of a placement left over from the last tick
+  uint64_t sent = 0;
+  uint64_t skipped = 0;
+  uint64_t failed = 0;
+  uint64_t statuses[6] = {}; // by PlaceStatus
+  uint64_t batches = 0;
+  LatencyHistogram latency; // canvas round trip
+  static constexpr const char *name = "synthetic";
 };
 
-void fake_client(event_based_actor *self, CanvasMatrix matrix) {
-
-  auto feed = self->make_observable()
-                  .interval(std::chrono::milliseconds(1000))
-                  .map([](int64_t) {
-                    std::random_device dev;
-                    std::mt19937 rng(dev());
-                    std::uniform_int_distribution<int> dist(0, DIM - 1);
-                    int x = dist(rng);
-                    int y = dist(rng);
-                    int color = dist(rng);
-                    return SimpleMessage{x, y, color};
-                  })
-                  .share();
-  feed.for_each([self, matrix](SimpleMessage msg) {
-    aout(self) << "Set x : " << msg.set_x << "y : " << msg.set_y
-               << " color : " << msg.color << std::endl;
-    self->request(matrix, std::chrono::seconds(10), put_atom_v, msg.set_x,
-                  msg.set_y, msg.color)
-        .await([=](int result) {
-          aout(self) << "Set Color : " << result << std::endl;
-        });
-    self->request(matrix, std::chrono::seconds(10), get_atom_v, msg.set_x,
-                  msg.set_y)
-        .await([=](int color) {
-          if (color != msg.color)
-            aout(self) << "Color does not check out" << std::endl;
-        });
-  });
+void synthetic_place(stateful_actor<SyntheticState> *self,
+                     CanvasMatrix matrix) {
+  auto &st = self->state;
+  if (st.idle_users.empty()) {
+    ++st.skipped;
+    return;
+  }
+  auto user = st.idle_users.back();
+  st.idle_users.pop_back();
+  auto px = (*st.picker)(st.rng);
+  ++st.sent;
+  auto start = std::chrono::steady_clock::now();
+  self->request(matrix, std::chrono::seconds(10), put_atom_v, px.x, px.y,
+                px.color)
+      .then(
+          [self, user, start](int status) {
+            auto &st = self->state;
+            st.idle_users.push_back(user);
+            ++st.statuses[std::clamp(status, 0, 5)];
+            st.latency.record(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count()));
+          },
+          [self, user](const error &) {
+            self->state.idle_users.push_back(user);
+            ++self->state.failed;
+          });
 }
 
-// todo: Message broker
+void synthetic_report(stateful_actor<SyntheticState> *self) {
+  auto &st = self->state;
+  LatencyHistogram::Snapshot latency;
+  st.latency.merge_into(latency);
+  RPLACE_LOG(info, "synthetic load", "sent", st.sent, "ok", st.statuses[0],
+             "rejected", st.sent - st.statuses[0] - st.failed, "failed",
+             st.failed, "skipped", st.skipped, "batches", st.batches,
+             "p50_us", latency.quantile(0.5) / 1000, "p99_us",
+             latency.quantile(0.99) / 1000);
+}
 
-void websocket_handler(event_based_actor *self,
-                       trait::acceptor_resource<> events, CanvasMatrix matrix) {
+behavior synthetic_load(stateful_actor<SyntheticState> *self,
+                        CanvasMatrix matrix, LoadProfile profile) {
+  auto &st = self->state;
+  st.profile = profile;
+  st.picker.emplace(profile);
+  st.idle_users.resize(std::max<size_t>(profile.users, 1));
+  for (size_t i = 0; i < st.idle_users.size(); ++i)
+    st.idle_users[i] = static_cast<uint32_t>(i);
+  st.started = st.last_tick = std::chrono::steady_clock::now();
+  self->send(matrix, join_atom_v, actor_cast<actor>(self));
+  // Placements due since the last tick go out together, so the rate holds
+  // even though the timer fires with some jitter.
+  auto ticks = std::make_shared<int64_t>(0);
+  self->make_observable()
+      .interval(std::chrono::milliseconds(10))
+      .for_each([self, matrix, ticks](int64_t) {
+        auto &st = self->state;
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::duration<double> dt = now - st.last_tick;
+        st.last_tick = now;
+        st.carry += st.profile.rate_at(now - st.started) * dt.count();
+        for (; st.carry >= 1.0; st.carry -= 1.0)
+          synthetic_place(self, matrix);
+        if (++*ticks % 1000 == 0)
+          synthetic_report(self);
+      });
+  return {
+      [self](batch_atom, const CanvasBatchPtr &) { ++self->state.batches; },
+  };
+}
+
+// Negotiated in the upgrade request, e.g. /rplace?compression=deflate.
+// Batched placements need ?key=<batch-key> when the server sets a key, and
+// always while the cooldown is on, since batches are exempt from it.
+// ?user=<name> identifies the user for the cooldown; all connections of a
+// user go to the same connection group, which enforces it.
+struct SessionParams {
+  bool deflate = false;
+  bool may_batch = false;
+  uint64_t user = 0;    // user_key(name) without the top bit, 0 = anonymous
+  uint64_t address = 0; // user_key(client address), 0 = unknown
+};
+
+// Connection handed from an acceptor shard to a connection group.
+struct Connection {
+  async::consumer_resource<ws::frame> pull;
+  async::producer_resource<ws::frame> push;
+  SessionParams params;
+};
+
+CAF_ALLOW_UNSAFE_MESSAGE_TYPE(Connection)
+
+// Outbound side of one WebSocket connection. Echoes and broadcast batches are
+// merged into the same publisher, which feeds the connection's push resource.
+// `queued` counts frames pushed but not yet handed to the connection, which
+// bounds what a slow client can pile up in the publisher.
+struct Session {
+  Session(event_based_actor *self, SessionParams params)
+      : out(self), params(params) {}
+  flow::item_publisher<ws::frame> out;
+  SessionParams params;
+  uint64_t cooldown_key = 0;
+  TokenBucket bucket;     // inbound frames
+  bool throttled = false; // told the client about dropped frames
+  size_t queued = 0;
+  bool stale = false;     // dropped deltas, needs a snapshot
+  bool resyncing = false; // snapshot requested from the canvas
+  bool closed = false;    // hit max_session_frames
+  uint64_t recorded_as = 0; // session number in the placement recording
+};
+
+void session_push(Session &session, const ws::frame &frame) {
+  if (session.closed)
+    return;
+  if (session.queued >= max_session_frames) {
+    RPLACE_LOG_SAMPLED(info, 100, "session does not read, closing", "queued",
+                       session.queued);
+    session.closed = true;
+    session.out.close();
+    return;
+  }
+  ++session.queued;
+  session.out.push(frame);
+}
+
+// Single placement parsed but not yet sent to the canvas.
+struct PendingPlacement {
+  std::shared_ptr<Session> session;
+  std::optional<uint64_t> seq;
+  std::chrono::steady_clock::time_point parsed;
+  uint64_t trace = 0; // see Tracer, 0 = not sampled
+};
+
+// A connection group owns a share of all sessions: it parses their frames,
+// talks to the canvas on their behalf and fans batches out to them. Groups
+// run independently, so parsing spreads across the scheduler's workers.
+//
+// Placements are not sent to the canvas one by one. The group collects
+// everything it parses and flushes once its mailbox has caught up (see
+// flush_atom), so one canvas request and at most one ack frame per session
+// cover a whole burst of frames.
+struct GroupState {
+  std::unordered_map<uint64_t, std::shared_ptr<Session>> sessions;
+  uint64_t next_id = 0;
+  std::unique_ptr<CooldownTable> cooldowns; // null if disabled
+  std::shared_ptr<RateLimiter> limiter;
+  std::shared_ptr<CanvasAdmission> admission;
+  std::vector<Pixel> pending;            // next canvas put
+  std::vector<PendingPlacement> waiting; // origin of each pending pixel
+  // Sampled placements the canvas acknowledged, with the time of the ack.
+  // The next batch from the canvas carries them.
+  std::vector<std::pair<uint64_t, std::chrono::steady_clock::time_point>>
+      traced_acks;
+  // Snapshot frames of the last board copy, each encoded on first use.
+  CanvasImagePtr image;
+  std::optional<ws::frame> snapshot;          // plain colors
+  std::optional<ws::frame> deflated_snapshot; // for ?compression=deflate
+  Deflater snapshot_deflater{Z_BEST_SPEED};
+  ActorProbePtr probe;
+  static constexpr const char *name = "connection_group";
+};
+
+// Sends one ack frame per session for all placements that carried a seq.
+template <class StatusAt>
+void send_acks(const std::vector<PendingPlacement> &waiting,
+               StatusAt status_at) {
+  std::vector<std::pair<Session *, std::vector<Ack>>> acks;
+  for (size_t i = 0; i < waiting.size(); ++i) {
+    auto &session = waiting[i].session;
+    auto &seq = waiting[i].seq;
+    if (!seq)
+      continue;
+    auto j = std::find_if(acks.begin(), acks.end(), [&](const auto &entry) {
+      return entry.first == session.get();
+    });
+    if (j == acks.end())
+      j = acks.emplace(acks.end(), session.get(), std::vector<Ack>{});
+    j->second.push_back(Ack{*seq, status_at(i)});
+  }
+  for (auto &[session, list] : acks)
+    session_push(*session, ws::frame{encode_acks(list)});
+}
+
+void flush_placements(stateful_actor<GroupState> *self,
+                      CanvasMatrix matrix) {
+  auto &st = self->state;
+  if (st.pending.empty())
+    return;
+  std::vector<Pixel> pixels;
+  pixels.swap(st.pending);
+  auto waiting = std::make_shared<std::vector<PendingPlacement>>();
+  waiting->swap(st.waiting);
+  auto n = static_cast<int64_t>(pixels.size());
+  auto start = CanvasAdmission::clock::now();
+  self->request(matrix, std::chrono::seconds(10), put_atom_v,
+                std::move(pixels))
+      .then(
+          [self, waiting, n, start](const std::string &status) {
+            auto now = CanvasAdmission::clock::now();
+            self->state.admission->release(n, now - start);
+            for (auto &placement : *waiting) {
+              metrics().record(Stage::apply, now - placement.parsed);
+              if (placement.trace != 0) {
+                tracer().span(placement.trace, "canvas_apply",
+                              placement.parsed, now);
+                self->state.traced_acks.emplace_back(placement.trace, now);
+              }
+            }
+            RPLACE_LOG(debug, "placements applied", "count", status.size());
+            send_acks(*waiting, [&status](size_t i) {
+              return static_cast<PlaceStatus>(status[i] - '0');
+            });
+          },
+          [self, waiting, n, start](const error &) {
+            self->state.admission->release(
+                n, CanvasAdmission::clock::now() - start);
+            send_acks(*waiting, [](size_t) { return PlaceStatus::failed; });
+          });
+}
+
+// Snapshot of `image` in the format `session` negotiated. Groups resyncing
+// several sessions from the same board copy encode it once per format.
+std::optional<ws::frame> snapshot_frame(GroupState &st,
+                                        const CanvasImagePtr &image,
+                                        bool deflate) {
+  if (st.image != image) {
+    st.image = image;
+    st.snapshot.reset();
+    st.deflated_snapshot.reset();
+  }
+  auto &frame = deflate ? st.deflated_snapshot : st.snapshot;
+  if (!frame) {
+    std::vector<std::byte> buf;
+    if (!encode_snapshot(image->seq, image->bitmap,
+                         deflate ? &st.snapshot_deflater : nullptr, buf)) {
+      RPLACE_LOG(error, "encoding snapshot failed", "seq", image->seq);
+      return std::nullopt;
+    }
+    frame = ws::frame{make_span(buf)};
+  }
+  return frame;
+}
+
+void resync_session(stateful_actor<GroupState> *self, CanvasMatrix matrix,
+                    std::shared_ptr<Session> session) {
+  metrics().add(Counter::resyncs);
+  session->resyncing = true;
+  self->request(matrix, std::chrono::seconds(10), get_atom_v)
+      .then(
+          [self, session](const CanvasImagePtr &image) {
+            session->resyncing = false;
+            auto frame = snapshot_frame(self->state, image,
+                                        session->params.deflate);
+            if (!frame)
+              return;
+            session->stale = false;
+            session_push(*session, *frame);
+          },
+          [session](const error &) { session->resyncing = false; });
+}
+
+void add_session(stateful_actor<GroupState> *self, CanvasMatrix matrix,
+                 Connection conn) {
   using namespace std::literals;
-  using json = nlohmann::json;
-  auto n = std::make_shared<int>(0);
-  
-
-  events.observe_on(self).for_each([self, n,
-                                    matrix](const trait::accept_event<> &ev) {
-    std::cout << "*** added listener (n = " << ++*n << ")" << std::endl;
-    auto [pull, push] = ev.data();
-    pull.observe_on(self)
-        .do_on_next([&self, matrix](ws::frame frame) {
-          if (frame.is_text()) {
-            try {
-              auto o = json::parse(frame.as_text());
-              aout(self) << "Parsed " << o.dump() << std::endl;
-              auto x = o.at("x").get<int>();
-              auto y = o.at("y").get<int>();
-              auto color = o.at("color").get<int>();
-
-              self->request(matrix, 10s, put_atom_v, x, y, color)
-                  .await([=](int result) {
-                    aout(self) << "Set Color : " << result << std::endl;
+  auto &[pull, push, params] = conn;
+  auto id = self->state.next_id++;
+  auto session = std::make_shared<Session>(self, params);
+  // Anonymous sessions are rate limited on their own.
+  session->cooldown_key =
+      params.user != 0 ? params.user : (uint64_t{1} << 63) | id;
+  session->recorded_as = recorder().next_session();
+  std::weak_ptr<Session> weak = session;
+  session->out.as_observable()
+      .do_on_next([self, matrix, weak](const ws::frame &) {
+        auto session = weak.lock();
+        if (!session)
+          return;
+        --session->queued;
+        if (session->stale && !session->resyncing && session->queued == 0)
+          resync_session(self, matrix, session);
+      })
+      .subscribe(push);
+  self->state.sessions.emplace(id, session);
+  metrics().add(Counter::sessions_opened);
+  RPLACE_LOG(debug, "session added", "id", id, "sessions",
+             self->state.sessions.size());
+  pull.observe_on(self)
+      .do_finally([self, id] {
+        if (auto i = self->state.sessions.find(id);
+            i != self->state.sessions.end()) {
+          i->second->out.close();
+          self->state.sessions.erase(i);
+          metrics().add(Counter::sessions_closed);
+        }
+        RPLACE_LOG(debug, "session removed", "id", id, "sessions",
+                   self->state.sessions.size());
+      })
+      .for_each([self, matrix, session](const ws::frame &frame) {
+        ActorProbe::Scope scope{*self->state.probe};
+        if (session->closed)
+          return;
+        auto received = std::chrono::steady_clock::now();
+        auto trace = tracer().sample();
+        metrics().add(Counter::frames_received);
+        // Rate limits apply before any parsing, so flooding stays cheap.
+        auto verdict = self->state.limiter->admit_frame(
+            session->bucket, session->params.address);
+        if (verdict != RateLimiter::Verdict::ok) {
+          if (!session->throttled) {
+            session->throttled = true;
+            session_push(*session, ws::frame{encode_rate_limited()});
+          }
+          return;
+        }
+        session->throttled = false;
+        auto limited = trace != 0 ? std::chrono::steady_clock::now() : received;
+        tracer().span(trace, "rate_limit", received, limited);
+        if (!frame.is_text())
+          return;
+        Placement place;
+        PlacementBatch batch;
+        auto kind = parse_message(frame.as_text(), place, batch);
+        auto parsed = std::chrono::steady_clock::now();
+        metrics().record(Stage::parse, parsed - received);
+        tracer().span(trace, "parse", limited, parsed);
+        // Recorded as offered, before shedding and cooldowns.
+        if (recorder().enabled()) {
+          if (kind == MessageKind::placement)
+            recorder().record(session->recorded_as, place.x, place.y,
+                              place.color);
+          else if (kind == MessageKind::batch && session->params.may_batch)
+            for (auto &px : batch.pixels)
+              recorder().record(session->recorded_as, px.x, px.y, px.color);
+        }
+        auto &admission = *self->state.admission;
+        if (kind == MessageKind::batch && session->params.may_batch) {
+          auto seq = batch.seq;
+          auto n = batch.pixels.size();
+          if (!admission.try_acquire(static_cast<int64_t>(n))) {
+            std::string status(n, '0' + static_cast<int>(PlaceStatus::busy));
+            session_push(*session, ws::frame{encode_batch_ack(seq, status)});
+            return;
+          }
+          auto start = CanvasAdmission::clock::now();
+          self->request(matrix, 10s, put_atom_v, std::move(batch.pixels))
+              .then(
+                  [self, session, seq, n, start](const std::string &status) {
+                    auto elapsed = CanvasAdmission::clock::now() - start;
+                    self->state.admission->release(static_cast<int64_t>(n),
+                                                   elapsed);
+                    metrics().record(Stage::apply, elapsed);
+                    session_push(*session,
+                                 ws::frame{encode_batch_ack(seq, status)});
+                  },
+                  [self, session, seq, n, start](const error &) {
+                    self->state.admission->release(
+                        static_cast<int64_t>(n),
+                        CanvasAdmission::clock::now() - start);
+                    std::string status(
+                        n, '0' + static_cast<int>(PlaceStatus::failed));
+                    session_push(*session,
+                                 ws::frame{encode_batch_ack(seq, status)});
                   });
-            } catch (const std::exception) {
-              aout(self) << "Parsing failed " << frame.as_text() << std::endl;
-            }
+          return;
+        }
+        // Malformed batches and batches without the key are refused.
+        if (kind == MessageKind::batch || kind == MessageKind::bad_batch) {
+          if (kind == MessageKind::bad_batch)
+            metrics().add(Counter::parse_failures);
+          session_push(*session, ws::frame{encode_batch_ack(batch.seq, "")});
+          return;
+        }
+        if (kind == MessageKind::invalid) {
+          metrics().add(Counter::parse_failures);
+          RPLACE_LOG_SAMPLED(warn, 1000, "parsing failed", "frame",
+                             frame.as_text());
+          if (place.seq)
+            session_push(*session,
+                         ws::frame{encode_acks(
+                             {Ack{*place.seq, PlaceStatus::invalid}})});
+          else
+            session_push(*session, frame);
+          return;
+        }
+        RPLACE_LOG(debug, "parsed", "frame", frame.as_text());
+        auto &st = self->state;
+        // Shedding comes first so it never costs the user a cooldown.
+        if (!admission.try_acquire(1)) {
+          if (place.seq)
+            session_push(*session, ws::frame{encode_acks(
+                                       {Ack{*place.seq, PlaceStatus::busy}})});
+          else
+            session_push(*session, ws::frame{encode_busy()});
+          return;
+        }
+        if (st.cooldowns && Canvas::in_bounds(place.x, place.y)) {
+          auto left = st.cooldowns->try_acquire(session->cooldown_key);
+          if (left.count() > 0) {
+            admission.cancel(1);
+            metrics().add(Counter::cooldown_rejects);
+            auto ms = static_cast<uint32_t>(left.count());
+            if (place.seq)
+              session_push(*session,
+                           ws::frame{encode_acks(
+                               {Ack{*place.seq, PlaceStatus::cooldown, ms}})});
+            else
+              session_push(*session, ws::frame{encode_cooldown(ms)});
+            return;
           }
-        })
-        .do_finally([n] { //
-          std::cout << "*** removed listener (n = " << --*n << ")" << std::endl;
-        })
-        .subscribe(push);
-  });
+        }
+        if (st.pending.empty())
+          self->send(self, flush_atom_v);
+        st.pending.push_back(Pixel{place.x, place.y, place.color});
+        st.waiting.push_back(
+            PendingPlacement{session, place.seq, parsed, trace});
+        if (trace != 0) {
+          auto queued = std::chrono::steady_clock::now();
+          tracer().span(trace, "admit", parsed, queued);
+          tracer().span(trace, "receive", received, queued);
+        }
+        metrics().add(Counter::placements);
+        // Placements without a sequence number are echoed right away.
+        if (!place.seq)
+          session_push(*session, frame);
+      });
+}
+
+struct GroupConfig {
+  std::chrono::milliseconds cooldown{0}; // 0 disables the cooldown
+  size_t cooldown_capacity = 0;          // concurrent cooldowns per group
+  std::shared_ptr<RateLimiter> limiter;  // shared by all groups
+  std::shared_ptr<CanvasAdmission> admission;
+};
+
+behavior connection_group(stateful_actor<GroupState> *self,
+                          CanvasMatrix matrix, GroupConfig cfg) {
+  self->send(matrix, join_atom_v, actor_cast<actor>(self));
+  self->state.limiter = cfg.limiter;
+  self->state.admission = cfg.admission;
+  self->state.probe = introspection().add(GroupState::name, self->id());
+  if (cfg.cooldown.count() > 0)
+    self->state.cooldowns = std::make_unique<CooldownTable>(
+        cfg.cooldown_capacity, cfg.cooldown);
+  return {
+      // Arrives after all frames that were already queued when the first
+      // pending placement was parsed.
+      [self, matrix](flush_atom) {
+        ActorProbe::Scope scope{*self->state.probe};
+        flush_placements(self, matrix);
+      },
+      [self, matrix](open_atom, Connection &conn) {
+        ActorProbe::Scope scope{*self->state.probe};
+        add_session(self, matrix, std::move(conn));
+      },
+      // Batches arrive every batch_interval, which makes them a good clock
+      // for sampling the mailbox.
+      [self](batch_atom, const CanvasBatchPtr &batch) {
+        ActorProbe::Scope scope{*self->state.probe};
+        self->state.probe->sample_mailbox(self->mailbox().size());
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+        for (auto &[id, session] : self->state.sessions) {
+          if (session->stale)
+            continue;
+          if (session->queued >= max_queued_frames) {
+            // The client cannot keep up, stop queueing deltas for it.
+            RPLACE_LOG(info, "session fell behind, resyncing", "id", id);
+            session->stale = true;
+            continue;
+          }
+          auto deflated = session->params.deflate && !batch->deflated.empty();
+          auto &frame = deflated ? batch->deflated : batch->text;
+          session_push(*session, frame);
+          ++frames;
+          bytes += frame.size();
+        }
+        auto now = std::chrono::steady_clock::now();
+        metrics().record(Stage::broadcast, now - batch->applied);
+        for (auto &[trace, acked] : self->state.traced_acks)
+          tracer().span(trace, "broadcast", acked, now);
+        self->state.traced_acks.clear();
+        metrics().add(Counter::broadcast_frames, frames);
+        metrics().add(Counter::broadcast_bytes, bytes);
+      },
+  };
 }
 
-int caf_main(actor_system &sys) {
-
-  auto m = sys.spawn(canvas_matrix_actor);
-
-
-  auto server = ws::with(sys)
-                    .accept(8081)
-                    .max_connections(156)
-                    .on_request([](ws::acceptor<> &ac) {
-                      auto header = ac.header();
-                      if (header.path() == "/rplace") {
-                        std::cout << "REQUEST " << header.path() << " ACCEPTED"
-                                  << std::endl;
-                        ac.accept();
-                        return;
-                      }
-                      std::cout << "REQUEST " << header.path() << " DENIED"
-                                << std::endl;
-                      ac.reject(caf::error());
-                    })
-                    .start([&sys, &m](trait::acceptor_resource<> events) {
-                      sys.spawn(websocket_handler, events, m);
-                    });
-
-  if (!server) {
-    std::cerr << "*** unable to run : " << to_string(server.error()) << '\n';
+// Hands every connection accepted by one shard to a connection group. Known
+// users always map to the same group, anonymous ones are spread evenly.
+void websocket_handler(event_based_actor *self,
+                       trait::acceptor_resource<SessionParams> events,
+                       std::vector<actor> groups) {
+  auto next = std::make_shared<size_t>(0);
+  events.observe_on(self).for_each(
+      [self, groups, next](const trait::accept_event<SessionParams> &ev) {
+        auto [pull, push, params] = ev.data();
+        auto slot = params.user != 0 ? params.user : (*next)++;
+        auto &group = groups[slot % groups.size()];
+        self->send(group, open_atom_v, Connection{pull, push, params});
+      });
+}
+
+struct AcceptOptions {
+  std::string batch_key;
+  bool trust_proxy = false; // take the client address from proxy headers
+  std::shared_ptr<RateLimiter> limiter;
+  bool cooldown = false; // batches bypass it, so only key holders may batch
+};
+
+void on_rplace_request(ws::acceptor<SessionParams> &ac,
+                       const AcceptOptions &opts) {
+  auto header = ac.header();
+  if (header.path() == "/rplace") {
+    SessionParams params;
+    // CAF does not hand out the peer address here, so addresses are only
+    // known behind a proxy that reports them.
+    if (opts.trust_proxy)
+      if (auto addr = proxied_address(header); !addr.empty())
+        params.address = user_key(addr) | 1;
+    if (!opts.limiter->admit_handshake(params.address)) {
+      RPLACE_LOG_SAMPLED(info, 1000, "request throttled", "path",
+                         header.path());
+      ac.reject(caf::error());
+      return;
+    }
+    RPLACE_LOG(debug, "request accepted", "path", header.path());
+    auto &batch_key = opts.batch_key;
+    auto &query = header.query();
+    if (auto i = query.find("compression"); i != query.end())
+      params.deflate = i->second == "deflate";
+    if (batch_key.empty())
+      params.may_batch = !opts.cooldown;
+    else if (auto i = query.find("key"); i != query.end())
+      params.may_batch = i->second == batch_key;
+    if (auto i = query.find("user"); i != query.end() && !i->second.empty())
+      params.user = (user_key(i->second) >> 1) | 1;
+    ac.accept(params);
+    return;
+  }
+  RPLACE_LOG(info, "request denied", "path", header.path());
+  ac.reject(caf::error());
+}
+
+// GET /tile/<tx>/<ty>[?format=raw] with the tile version as ETag. Tiles are
+// served from the cache, clients holding the current version get a 304.
+void serve_tile(http::responder &res, const TileCache &cache, int tx,
+                int ty) {
+  if (tx < 0 || tx >= Canvas::tiles_per_side || ty < 0 ||
+      ty >= Canvas::tiles_per_side) {
+    res.respond(http::status::not_found, "text/plain", "No such tile.");
+    return;
+  }
+  auto tile = cache.get(tx + ty * Canvas::tiles_per_side);
+  if (!tile) {
+    res.respond(http::status::service_unavailable, "text/plain",
+                "Tile not ready.");
+    return;
+  }
+  auto etag = tile->etag();
+  auto *down = res.down();
+  if (etag_matches(res.header().field("If-None-Match"), etag)) {
+    down->begin_header(http::status::not_modified);
+    down->add_header_field("ETag", etag);
+    down->end_header();
+    return;
+  }
+  auto format = TileFormat::png;
+  auto &query = res.header().query();
+  if (auto i = query.find("format"); i != query.end() && i->second == "raw")
+    format = TileFormat::raw;
+  auto &body = tile->encoded(format);
+  down->begin_header(http::status::ok);
+  down->add_header_field("Content-Type", format == TileFormat::png
+                                             ? "image/png"
+                                             : "application/octet-stream");
+  down->add_header_field("Content-Length", std::to_string(body.size()));
+  down->add_header_field("ETag", etag);
+  down->add_header_field("Cache-Control", "no-cache");
+  down->end_header();
+  down->send_payload(make_span(body));
+}
+
+// GET /metrics in the Prometheus text format: the server's counters and
+// gauges, per-actor probes and per-thread CPU time, followed by everything in
+// CAF's metric registry (actors, messages, mailboxes of actors matched by
+// caf.metrics-filters, process stats).
+class MetricsEndpoint {
+public:
+  MetricsEndpoint(actor_system &sys, std::shared_ptr<CanvasAdmission> admission,
+                  std::shared_ptr<RateLimiter> limiter,
+                  std::shared_ptr<SpectatorHub> spectators)
+      : sys_(sys), admission_(std::move(admission)),
+        limiter_(std::move(limiter)), spectators_(std::move(spectators)) {
+    if (telemetry::importer::process::is_supported())
+      process_ = std::make_unique<telemetry::importer::process>(sys.metrics());
+  }
+
+  std::string scrape() {
+    std::string out;
+    metrics().render(out);
+    auto opened = metrics().get(Counter::sessions_opened);
+    auto closed = metrics().get(Counter::sessions_closed);
+    render_gauge(out, "rplace_sessions", opened - closed);
+    render_gauge(out, "rplace_spectators", spectators_->spectators());
+    render_gauge(out, "rplace_canvas_in_flight", admission_->in_flight());
+    render_gauge(out, "rplace_canvas_latency_seconds",
+                 admission_->latency().count() / 1e6);
+    render_counter(out, "rplace_placements_shed_total", admission_->shed());
+    render_counter(out, "rplace_log_dropped_lines_total", logger().dropped());
+    limiter_->render(out);
+    introspection().render(out);
+    std::lock_guard<std::mutex> guard{mtx_};
+    if (process_)
+      process_->update();
+    auto caf_metrics = collector_.collect_from(sys_.metrics());
+    out.append(caf_metrics.data(), caf_metrics.size());
+    return out;
+  }
+
+private:
+  actor_system &sys_;
+  std::shared_ptr<CanvasAdmission> admission_;
+  std::shared_ptr<RateLimiter> limiter_;
+  std::shared_ptr<SpectatorHub> spectators_;
+  std::mutex mtx_; // guards the collector and importer
+  telemetry::collector::prometheus collector_;
+  std::unique_ptr<telemetry::importer::process> process_;
+};
+
+// Pins CAF's threads to the CPUs of --pin-workers and --pin-network as they
+// start. The lists are only parsed in init(), i.e. after the config has read
+// the command line but before the scheduler starts its workers.
+class PinningHook : public thread_hook {
+public:
+  PinningHook(const std::string *workers, const std::string *network)
+      : workers_(workers), network_(network) {}
+
+  void init(actor_system &) override {
+    // Malformed lists are reported by caf_main, which runs later.
+    parse_cpu_list(*workers_, plan_.workers);
+    parse_cpu_list(*network_, plan_.network);
+  }
+
+  void thread_started(thread_owner owner) override {
+    auto cpu = -1;
+    if (owner == thread_owner::scheduler)
+      cpu = plan_.next_worker();
+    else if (current_thread_name().rfind("caf.net", 0) == 0)
+      cpu = plan_.next_network();
+    if (cpu >= 0 && !pin_current_thread(cpu))
+      RPLACE_LOG(warn, "pinning a thread failed", "cpu", cpu);
+  }
+
+  void thread_terminates() override {
+    // nop
+  }
+
+private:
+  const std::string *workers_;
+  const std::string *network_;
+  AffinityPlan plan_;
+};
+
+// Per-connection memory budget for mostly idle clients, roughly:
+//  - kernel socket buffers: capped by socket-buffer (default 16 KiB each way,
+//    the kernel only allocates them while data is in flight),
+//  - CAF transport and WebSocket framing: a few KiB, grown on demand by large
+//    frames and released again with the frame,
+//  - Session and its flow pipeline: well under 1 KiB; the publisher only holds
+//    frames while the connection drains them (see max_queued_frames).
+// scripts/idle_connections.py measures the actual number on a given box.
+struct config : actor_system_config {
+  config() {
+    // Lets CAF record mailbox size and processing time histograms for our
+    // long-lived actors (see /metrics); override with
+    // --caf.metrics-filters.actors.includes=[...].
+    set("caf.metrics-filters.actors.includes",
+        std::vector<std::string>{MatrixState::name, GroupState::name});
+    // The scheduler itself is tuned with CAF's own options:
+    // --caf.scheduler.policy=stealing|sharing and
+    // --caf.scheduler.max-threads=N (default: one worker per core).
+    add_thread_hook<PinningHook>(&pin_workers, &pin_network);
+    opt_group{custom_options_, "global"}
+        .add(port, "port,p", "WebSocket port for /rplace")
+        .add(max_connections, "max-connections",
+             "maximum number of concurrent WebSocket connections")
+        .add(http_port, "http-port",
+             "HTTP port for read-only endpoints such as /tile (0 = off)")
+        .add(http_address, "http-address",
+             "address the HTTP port listens on; it also serves /metrics and "
+             "/debug/actors, so the default is loopback only (0.0.0.0 = all)")
+        .add(sse_port, "sse-port",
+             "port of the read-only /stream of batches for spectators (0 = "
+             "off)")
+        .add(session_groups, "session-groups",
+             "number of actors sharing the sessions (0 = one per core)")
+        .add(cooldown, "cooldown",
+             "time a user must wait between placements, at most 109 min "
+             "(0 = no limit)")
+        .add(cooldown_capacity, "cooldown-capacity",
+             "number of users that can be on cooldown at the same time")
+        .add(session_rate, "session-rate",
+             "inbound frames per second per session (0 = no limit)")
+        .add(session_burst, "session-burst",
+             "frames a session may send at once before session-rate applies")
+        .add(address_rate, "address-rate",
+             "frames and handshakes per second per client address (0 = no "
+             "limit)")
+        .add(address_burst, "address-burst",
+             "frames an address may send at once before address-rate applies")
+        .add(trust_proxy, "trust-proxy",
+             "take client addresses from X-Real-IP/X-Forwarded-For")
+        .add(canvas_max_in_flight, "canvas-max-in-flight",
+             "placements queued towards the canvas before new ones are "
+             "answered with busy (0 = no limit)")
+        .add(canvas_target_latency, "canvas-target-latency",
+             "average canvas round trip above which placements are shed "
+             "(0 = ignore)")
+        .add(batch_key, "batch-key",
+             "key clients pass as ?key= to send batched placements (empty = "
+             "anyone may, unless cooldown is set)")
+        .add(listeners, "listeners",
+             "number of acceptor shards sharing the port via SO_REUSEPORT")
+        .add(trace_file, "trace-file",
+             "write sampled placement traces to this file in the Chrome "
+             "trace event format (empty = off)")
+        .add(trace_every, "trace-every",
+             "trace one in this many frames per thread")
+        .add(record_file, "record-file",
+             "record all incoming placements to this file for replay with "
+             "loadgen --replay (empty = off)")
+        .add(log_level, "log-level",
+             "debug, info, warn or error; debug needs a build with "
+             "-DRPLACE_MIN_LOG_LEVEL=0")
+        .add(socket_buffer, "socket-buffer",
+             "SO_RCVBUF/SO_SNDBUF of accepted sockets in bytes (0 = kernel "
+             "default)")
+        .add(canvas_thread, "canvas-thread",
+             "run the canvas actor on a dedicated thread instead of the "
+             "scheduler")
+        .add(pin_canvas, "pin-canvas",
+             "CPU for the dedicated canvas thread (-1 = any, needs "
+             "canvas-thread)")
+        .add(pin_workers, "pin-workers",
+             "CPUs for the scheduler workers, e.g. 0-3,8 (empty = any; Linux "
+             "only)")
+        .add(pin_network, "pin-network",
+             "CPUs for the network multiplexer thread (empty = any; Linux "
+             "only)");
+    opt_group{custom_options_, "synthetic"}
+        .add(synthetic.rate, "rate",
+             "in-process placements per second, no sockets involved (0 = "
+             "off)")
+        .add(synthetic.users, "users",
+             "virtual users, each with at most one placement in flight")
+        .add(synthetic_distribution, "distribution",
+             "where placements land: uniform, zipf or hotspot")
+        .add(synthetic.zipf_exponent, "zipf-exponent",
+             "skew of the zipf distribution")
+        .add(synthetic.hotspot_size, "hotspot-size",
+             "edge length of the hot square in the center of the canvas")
+        .add(synthetic.hotspot_share, "hotspot-share",
+             "share of placements that go to the hot square")
+        .add(synthetic_burst_every, "burst-every",
+             "start a burst this often (0 = steady rate)")
+        .add(synthetic_burst_length, "burst-length", "duration of a burst")
+        .add(synthetic.burst_factor, "burst-factor",
+             "rate multiplier during a burst");
+  }
+  uint16_t port = 8081;
+  uint16_t http_port = 8082;
+  std::string http_address = "127.0.0.1";
+  uint16_t sse_port = 8083;
+  size_t max_connections = 200'000;
+  size_t listeners = 1;
+  size_t session_groups = 0;
+  timespan cooldown{0};
+  size_t cooldown_capacity = 1'000'000;
+  double session_rate = 0;
+  double session_burst = 20;
+  double address_rate = 0;
+  double address_burst = 100;
+  bool trust_proxy = false;
+  int64_t canvas_max_in_flight = 100'000;
+  timespan canvas_target_latency = std::chrono::milliseconds(250);
+  std::string batch_key;
+  int32_t socket_buffer = 16 * 1024;
+  std::string log_level = "info";
+  std::string trace_file;
+  uint32_t trace_every = 1000;
+  std::string record_file;
+  bool canvas_thread = false;
+  int32_t pin_canvas = -1;
+  std::string pin_workers;
+  std::string pin_network;
+  LoadProfile synthetic;
+  std::string synthetic_distribution = "uniform";
+  timespan synthetic_burst_every{0};
+  timespan synthetic_burst_length = std::chrono::seconds(1);
+};
+
+int caf_main(actor_system &sys, const config &cfg) {
+
+  if (LogLevel level; parse_log_level(cfg.log_level, level)) {
+    logger().set_level(level);
+  } else {
+    std::cerr << "*** invalid log-level: " << cfg.log_level << '\n';
     return EXIT_FAILURE;
   }
+  if (cfg.cooldown > CooldownTable::max_cooldown()) {
+    std::cerr << "*** cooldown must not exceed "
+              << std::chrono::duration_cast<std::chrono::minutes>(
+                     CooldownTable::max_cooldown())
+                     .count()
+              << " minutes\n";
+    return EXIT_FAILURE;
+  }
+  std::signal(SIGUSR1, request_latency_dump);
+  if (!cfg.trace_file.empty() &&
+      !tracer().open(cfg.trace_file, std::max(cfg.trace_every, 1u))) {
+    std::cerr << "*** unable to open trace file " << cfg.trace_file << '\n';
+    return EXIT_FAILURE;
+  }
+  if (!cfg.record_file.empty() && !recorder().open(cfg.record_file)) {
+    std::cerr << "*** unable to open record file " << cfg.record_file << '\n';
+    return EXIT_FAILURE;
+  }
+  auto tiles = std::make_shared<TileCache>();
+  auto spectators = std::make_shared<SpectatorHub>(max_queued_frames);
+  if (cfg.sse_port != 0) {
+    std::string err;
+    if (!spectators->start(cfg.sse_port, cfg.socket_buffer, err)) {
+      std::cerr << "*** unable to listen on port " << cfg.sse_port << ": "
+                << err << '\n';
+      return EXIT_FAILURE;
+    }
+  }
+  std::vector<int> cpus;
+  for (auto *list : {&cfg.pin_workers, &cfg.pin_network}) {
+    if (!parse_cpu_list(*list, cpus)) {
+      std::cerr << "*** invalid CPU list: " << *list << '\n';
+      return EXIT_FAILURE;
+    }
+  }
+  if (cfg.pin_canvas >= 0 && !cfg.canvas_thread) {
+    std::cerr << "*** pin-canvas needs canvas-thread\n";
+    return EXIT_FAILURE;
+  }
+  // A dedicated thread keeps the canvas, which every placement goes
+  // through, from waiting behind session groups on a busy worker.
+  auto m = cfg.canvas_thread
+               ? sys.spawn<detached>(canvas_matrix_actor, tiles, spectators,
+                                     static_cast<int>(cfg.pin_canvas))
+               : sys.spawn(canvas_matrix_actor, tiles, spectators, -1);
+  if (cfg.synthetic.rate > 0) {
+    auto profile = cfg.synthetic;
+    if (!parse_distribution(cfg.synthetic_distribution,
+                            profile.distribution)) {
+      std::cerr << "*** invalid synthetic.distribution: "
+                << cfg.synthetic_distribution << '\n';
+      return EXIT_FAILURE;
+    }
+    profile.burst_every = std::chrono::duration_cast<std::chrono::milliseconds>(
+        cfg.synthetic_burst_every);
+    profile.burst_length =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            cfg.synthetic_burst_length);
+    sys.spawn(synthetic_load, m, profile);
+  }
+
+  auto fd_limit = raise_fd_limit();
+  if (fd_limit < cfg.max_connections)
+    std::cerr << "*** warning: file descriptor limit " << fd_limit
+              << " is below max-connections " << cfg.max_connections << '\n';
+  std::vector<actor> groups;
+  auto group_count = cfg.session_groups != 0
+                         ? cfg.session_groups
+                         : std::max(std::thread::hardware_concurrency(), 1u);
+  auto limiter = std::make_shared<RateLimiter>(
+      RateLimit{cfg.session_rate, cfg.session_burst},
+      RateLimit{cfg.address_rate, cfg.address_burst});
+  if (limiter->limits_addresses() && !cfg.trust_proxy)
+    std::cerr << "*** warning: address-rate needs trust-proxy, client "
+                 "addresses are unknown otherwise\n";
+  if (cfg.cooldown.count() > 0 && cfg.batch_key.empty())
+    std::cerr << "*** warning: cooldown without batch-key, batched "
+                 "placements are refused\n";
+  auto admission = std::make_shared<CanvasAdmission>(
+      cfg.canvas_max_in_flight,
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          cfg.canvas_target_latency));
+  GroupConfig group_cfg;
+  group_cfg.limiter = limiter;
+  group_cfg.admission = admission;
+  group_cfg.cooldown =
+      std::chrono::duration_cast<std::chrono::milliseconds>(cfg.cooldown);
+  group_cfg.cooldown_capacity =
+      std::max<size_t>(cfg.cooldown_capacity / group_count, 1);
+  for (size_t i = 0; i < group_count; ++i)
+    groups.push_back(sys.spawn(connection_group, m, group_cfg));
+
+  // One acceptor per shard, all bound to the same port. The kernel spreads
+  // incoming connections across the shards and every shard gets its own
+  // websocket_handler, which feeds the shared pool of connection groups.
+  auto shards = std::max<size_t>(cfg.listeners, 1);
+  auto per_shard = (cfg.max_connections + shards - 1) / shards;
+  for (size_t shard = 0; shard < shards; ++shard) {
+    std::string err;
+    auto fd =
+        make_listen_socket(cfg.port, cfg.socket_buffer, shards > 1, err);
+    if (fd < 0) {
+      std::cerr << "*** unable to listen on port " << cfg.port << ": " << err
+                << '\n';
+      return EXIT_FAILURE;
+    }
+    auto server =
+        ws::with(sys)
+            .accept(net::tcp_accept_socket{fd})
+            .max_connections(per_shard)
+            .on_request([opts = AcceptOptions{cfg.batch_key, cfg.trust_proxy,
+                                              limiter,
+                                              cfg.cooldown.count() > 0}](
+                            ws::acceptor<SessionParams> &ac) {
+              on_rplace_request(ac, opts);
+            })
+            .start([&sys, &groups](
+                       trait::acceptor_resource<SessionParams> events) {
+              sys.spawn(websocket_handler, events, groups);
+            });
+    if (!server) {
+      std::cerr << "*** unable to run : " << to_string(server.error())
+                << '\n';
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (cfg.http_port != 0) {
+    auto endpoint = std::make_shared<MetricsEndpoint>(sys, admission, limiter,
+                                                      spectators);
+    auto server =
+        http::with(sys)
+            .accept(cfg.http_port, cfg.http_address)
+            .route("/tile/<arg>/<arg>", http::method::get,
+                   [tiles](http::responder &res, int tx, int ty) {
+                     serve_tile(res, *tiles, tx, ty);
+                   })
+            .route("/debug/actors", http::method::get,
+                   [](http::responder &res) {
+                     res.respond(http::status::ok, "text/plain",
+                                 introspection().report());
+                   })
+            .route("/metrics", http::method::get,
+                   [endpoint](http::responder &res) {
+                     res.respond(http::status::ok,
+                                 "text/plain; version=0.0.4",
+                                 endpoint->scrape());
+                   })
+            .start();
+    if (!server) {
+      std::cerr << "*** unable to serve HTTP : " << to_string(server.error())
+                << '\n';
+      return EXIT_FAILURE;
+    }
+  }
   return EXIT_SUCCESS;
 }
 
-CAF_MAIN(caf::net::middleman)
+CAF_MAIN(id_block::rplace, caf::net::middleman)
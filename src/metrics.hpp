@@ -0,0 +1,201 @@
+#pragma once
+
+#include "histogram.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Monotonic event counters of the server, exported as rplace_<name>_total.
+enum class Counter : size_t {
+  frames_received,
+  parse_failures,
+  placements,        // single placements handed towards the canvas
+  pixels_applied,    // pixels the canvas accepted, batches included
+  cooldown_rejects,
+  sessions_opened,
+  sessions_closed,
+  batches_published, // by the canvas, once per batch
+  broadcast_frames,  // batch frames queued for sessions
+  broadcast_bytes,
+  resyncs,
+  count_ // not a counter
+};
+
+constexpr const char *counter_names[] = {
+    "frames_received",  "parse_failures",    "placements",
+    "pixels_applied",   "cooldown_rejects",  "sessions_opened",
+    "sessions_closed",  "batches_published", "broadcast_frames",
+    "broadcast_bytes",  "resyncs",
+};
+
+static_assert(std::size(counter_names) ==
+              static_cast<size_t>(Counter::count_));
+
+// Stages of a placement, each with its own latency histogram:
+//  - parse: a group picked up the frame until it was parsed and queued,
+//  - apply: parsed until the canvas acknowledged it to the group,
+//  - broadcast: the canvas applied the oldest pixel of a batch until a group
+//    queued the batch for its sessions.
+enum class Stage : size_t { parse, apply, broadcast, count_ };
+
+constexpr const char *stage_names[] = {"parse", "apply", "broadcast"};
+
+static_assert(std::size(stage_names) == static_cast<size_t>(Stage::count_));
+
+// Counters without shared writes: every thread bumps its own cache-line
+// aligned block, and a scrape sums up all blocks. A block has exactly one
+// writer, so increments are a plain load and store instead of a locked
+// read-modify-write. Blocks of exited threads stay registered, so their
+// counts are never lost. Use the single instance returned by metrics(); the
+// per-thread block pointer is shared by all instances.
+class Metrics {
+public:
+  void add(Counter counter, uint64_t n = 1) {
+    auto &value = local().values[static_cast<size_t>(counter)];
+    value.store(value.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+  }
+
+  void record(Stage stage, std::chrono::nanoseconds elapsed) {
+    local().stages[static_cast<size_t>(stage)].record(
+        static_cast<uint64_t>(std::max<int64_t>(elapsed.count(), 0)));
+  }
+
+  LatencyHistogram::Snapshot latency(Stage stage) const {
+    LatencyHistogram::Snapshot result;
+    std::lock_guard<std::mutex> guard{mtx_};
+    for (auto &block : blocks_)
+      block->stages[static_cast<size_t>(stage)].merge_into(result);
+    return result;
+  }
+
+  uint64_t get(Counter counter) const {
+    uint64_t sum = 0;
+    std::lock_guard<std::mutex> guard{mtx_};
+    for (auto &block : blocks_)
+      sum += block->values[static_cast<size_t>(counter)].load(
+          std::memory_order_relaxed);
+    return sum;
+  }
+
+  // Appends all counters in the Prometheus text format.
+  void render(std::string &out) const {
+    std::array<uint64_t, static_cast<size_t>(Counter::count_)> sums{};
+    {
+      std::lock_guard<std::mutex> guard{mtx_};
+      for (auto &block : blocks_)
+        for (size_t i = 0; i < sums.size(); ++i)
+          sums[i] += block->values[i].load(std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < sums.size(); ++i) {
+      std::string name = "rplace_";
+      name += counter_names[i];
+      name += "_total";
+      out += "# TYPE " + name + " counter\n";
+      out += name + ' ' + std::to_string(sums[i]) + '\n';
+    }
+    // Quantiles over the whole uptime, as a summary per stage.
+    out += "# TYPE rplace_stage_latency_seconds summary\n";
+    for (size_t i = 0; i < std::size(stage_names); ++i) {
+      auto hist = latency(static_cast<Stage>(i));
+      std::string label = "{stage=\"";
+      label += stage_names[i];
+      label += '"';
+      for (auto q : {0.5, 0.9, 0.99, 0.999})
+        out += "rplace_stage_latency_seconds" + label + ",quantile=\"" +
+               number(q) + "\"} " + seconds(hist.quantile(q)) + '\n';
+      out += "rplace_stage_latency_seconds_sum" + label + "} " +
+             seconds(hist.sum) + '\n';
+      out += "rplace_stage_latency_seconds_count" + label + "} " +
+             std::to_string(hist.count) + '\n';
+    }
+  }
+
+  // Human-readable quantiles per stage, e.g. for a dump on a signal.
+  std::string latency_report() const {
+    std::string out = "stage      count        p50        p99       p999"
+                      "        max (us)\n";
+    for (size_t i = 0; i < std::size(stage_names); ++i) {
+      auto hist = latency(static_cast<Stage>(i));
+      char line[128];
+      std::snprintf(line, sizeof(line),
+                    "%-9s %6llu %10.1f %10.1f %10.1f %10.1f\n", stage_names[i],
+                    static_cast<unsigned long long>(hist.count),
+                    hist.quantile(0.5) / 1e3, hist.quantile(0.99) / 1e3,
+                    hist.quantile(0.999) / 1e3, hist.max / 1e3);
+      out += line;
+    }
+    return out;
+  }
+
+private:
+  struct alignas(64) Block {
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(Counter::count_)>
+        values{};
+    std::array<LatencyHistogram, static_cast<size_t>(Stage::count_)> stages;
+  };
+
+  static std::string number(double value) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.9g", value);
+    return buf;
+  }
+
+  static std::string seconds(uint64_t ns) {
+    return number(static_cast<double>(ns) / 1e9);
+  }
+
+  Block &local() {
+    thread_local Block *block = nullptr;
+    if (block == nullptr) {
+      std::lock_guard<std::mutex> guard{mtx_};
+      blocks_.push_back(std::make_unique<Block>());
+      block = blocks_.back().get();
+    }
+    return *block;
+  }
+
+  mutable std::mutex mtx_;
+  std::vector<std::unique_ptr<Block>> blocks_;
+};
+
+// Process-wide instance, so instrumentation does not need to be threaded
+// through every actor.
+inline Metrics &metrics() {
+  static Metrics instance;
+  return instance;
+}
+
+// Appends one monotonic counter in the Prometheus text format. `name` must
+// end in _total.
+template <class T>
+void render_counter(std::string &out, const char *name, T value) {
+  out += "# TYPE ";
+  out += name;
+  out += " counter\n";
+  out += name;
+  out += ' ';
+  out += std::to_string(value);
+  out += '\n';
+}
+
+// Appends one gauge in the Prometheus text format.
+template <class T>
+void render_gauge(std::string &out, const char *name, T value) {
+  out += "# TYPE ";
+  out += name;
+  out += " gauge\n";
+  out += name;
+  out += ' ';
+  out += std::to_string(value);
+  out += '\n';
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "canvas.hpp"
+
+#include <climits>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Client placement: {"x":1,"y":2,"color":3[,"seq":4]}. Without a seq the
+// server echoes the message back; with one it answers with an ack instead,
+// so clients may keep many placements in flight.
+struct Placement {
+  int x = 0;
+  int y = 0;
+  int color = 0;
+  std::optional<uint64_t> seq;
+};
+
+// Many pixels in one message, applied by the canvas as one operation:
+// {"type":"place","seq":4,"pixels":[[x,y,color],...]}. Answered with
+// {"type":"batch_ack","seq":4,"status":"0010"}, one PlaceStatus digit per
+// record, or {"type":"batch_ack","seq":4,"error":"invalid"} if malformed.
+struct PlacementBatch {
+  std::optional<uint64_t> seq;
+  std::vector<Pixel> pixels;
+};
+
+constexpr size_t max_batch_pixels = 4096;
+
+// `bad_batch` is a "place" message that failed validation; batch.seq is set
+// if the message carried one, so the client still gets its batch_ack. The
+// same goes for place.seq of an `invalid` placement, which gets an ack with
+// PlaceStatus::invalid instead of an echo.
+enum class MessageKind { invalid, placement, batch, bad_batch };
+
+// Reads an integer that fits into int32_t. Rejects everything else, including
+// 64-bit values that get<int32_t>() would silently wrap into range.
+inline bool get_int32(const nlohmann::json &value, int32_t &out) {
+  if (value.is_number_unsigned()) {
+    auto n = value.get<uint64_t>();
+    if (n > static_cast<uint64_t>(INT32_MAX))
+      return false;
+    out = static_cast<int32_t>(n);
+    return true;
+  }
+  if (!value.is_number_integer())
+    return false;
+  auto n = value.get<int64_t>();
+  if (n < INT32_MIN || n > INT32_MAX)
+    return false;
+  out = static_cast<int32_t>(n);
+  return true;
+}
+
+inline MessageKind parse_message(std::string_view text, Placement &place,
+                                 PlacementBatch &batch) {
+  using json = nlohmann::json;
+  place.seq.reset();
+  auto o = json::parse(text, nullptr, false);
+  if (!o.is_object())
+    return MessageKind::invalid;
+  auto seq = o.find("seq");
+  auto type = o.find("type");
+  if (type != o.end() && type->is_string() &&
+      type->get<std::string_view>() == "place") {
+    batch.seq.reset();
+    batch.pixels.clear();
+    if (seq != o.end() && seq->is_number_unsigned())
+      batch.seq = seq->get<uint64_t>();
+    auto pixels = o.find("pixels");
+    if (pixels == o.end() || !pixels->is_array() ||
+        pixels->size() > max_batch_pixels)
+      return MessageKind::bad_batch;
+    batch.pixels.reserve(pixels->size());
+    for (auto &rec : *pixels) {
+      Pixel px{};
+      if (!rec.is_array() || rec.size() != 3 || !get_int32(rec[0], px.x) ||
+          !get_int32(rec[1], px.y) || !get_int32(rec[2], px.color))
+        return MessageKind::bad_batch;
+      batch.pixels.push_back(px);
+    }
+    return MessageKind::batch;
+  }
+  if (seq != o.end()) {
+    if (!seq->is_number_unsigned())
+      return MessageKind::invalid;
+    place.seq = seq->get<uint64_t>();
+  }
+  auto x = o.find("x");
+  auto y = o.find("y");
+  auto color = o.find("color");
+  if (x == o.end() || y == o.end() || color == o.end() ||
+      !get_int32(*x, place.x) || !get_int32(*y, place.y) ||
+      !get_int32(*color, place.color))
+    return MessageKind::invalid;
+  return MessageKind::placement;
+}
+
+inline bool parse_placement(std::string_view text, Placement &out) {
+  PlacementBatch unused;
+  return parse_message(text, out, unused) == MessageKind::placement;
+}
+
+struct Ack {
+  uint64_t seq;
+  PlaceStatus status;
+  uint32_t retry_ms = 0; // remaining cooldown
+};
+
+// {"type":"ack","acks":[[seq,status],...]}, status as in PlaceStatus. Acks
+// rejected by the cooldown carry the time left: [seq,4,retry_ms].
+inline std::string encode_acks(const std::vector<Ack> &acks) {
+  std::string out = R"({"type":"ack","acks":[)";
+  for (size_t i = 0; i < acks.size(); ++i) {
+    if (i > 0)
+      out += ',';
+    out += '[';
+    out += std::to_string(acks[i].seq);
+    out += ',';
+    out += std::to_string(static_cast<int>(acks[i].status));
+    if (acks[i].retry_ms > 0) {
+      out += ',';
+      out += std::to_string(acks[i].retry_ms);
+    }
+    out += ']';
+  }
+  out += "]}";
+  return out;
+}
+
+// `status` holds one PlaceStatus digit per record, empty for a malformed
+// batch.
+inline std::string encode_batch_ack(std::optional<uint64_t> seq,
+                                    std::string_view status) {
+  std::string out = R"({"type":"batch_ack")";
+  if (seq) {
+    out += R"(,"seq":)";
+    out += std::to_string(*seq);
+  }
+  if (status.empty()) {
+    out += R"(,"error":"invalid"})";
+    return out;
+  }
+  out += R"(,"status":")";
+  out += status;
+  out += "\"}";
+  return out;
+}
+
+// Answer to a placement without seq that hit the cooldown.
+inline std::string encode_cooldown(uint32_t remaining_ms) {
+  return R"({"type":"cooldown","remaining_ms":)" +
+         std::to_string(remaining_ms) + "}";
+}
+
+// Answer to a placement without seq that was shed under load.
+inline std::string encode_busy() { return R"({"type":"busy"})"; }
+
+// Sent once when a session starts losing frames to the rate limit. Frames
+// are dropped unread, so their placements get no ack.
+inline std::string encode_rate_limited() {
+  return R"({"type":"rate_limited"})";
+}
+
+// Stable 64-bit FNV-1a hash of a user name or address, used as key for
+// cooldowns and rate limits.
+inline uint64_t user_key(std::string_view user) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (auto c : user) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
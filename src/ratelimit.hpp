@@ -0,0 +1,156 @@
+#pragma once
+
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// `rate` tokens per second, at most `burst` saved up. A rate of 0 disables
+// the limit.
+struct RateLimit {
+  double rate = 0;
+  double burst = 0;
+  bool enabled() const { return rate > 0; }
+};
+
+// Token bucket that does not store its own limit, so it stays at 16 bytes
+// per session or address. Starts full.
+class TokenBucket {
+public:
+  using clock = std::chrono::steady_clock;
+
+  bool take(const RateLimit &limit, clock::time_point now) {
+    if (last_ == clock::time_point{}) {
+      tokens_ = limit.burst;
+    } else if (now > last_) {
+      std::chrono::duration<double> elapsed = now - last_;
+      tokens_ = std::min(limit.burst, tokens_ + elapsed.count() * limit.rate);
+    }
+    last_ = now;
+    if (tokens_ < 1)
+      return false;
+    tokens_ -= 1;
+    return true;
+  }
+
+  // True if the bucket refilled completely, i.e. it carries no state worth
+  // keeping.
+  bool full(const RateLimit &limit, clock::time_point now) const {
+    std::chrono::duration<double> idle = now - last_;
+    return tokens_ + idle.count() * limit.rate >= limit.burst;
+  }
+
+private:
+  double tokens_ = 0;
+  clock::time_point last_;
+};
+
+// Limits for all sessions plus one bucket per client address shared by all
+// connection groups, and counters of what got rejected. Addresses are
+// identified by a hash (see user_key) so lookups never allocate. The address
+// table is split into shards with their own lock and prunes refilled buckets
+// once a shard runs full.
+class RateLimiter {
+public:
+  using clock = TokenBucket::clock;
+
+  enum class Verdict { ok, session, address };
+
+  RateLimiter(RateLimit per_session, RateLimit per_address,
+              size_t max_addresses = 1 << 20)
+      : per_session_(per_session), per_address_(per_address),
+        max_per_shard_(std::max<size_t>(max_addresses / shard_count, 1)) {}
+
+  // Charges one inbound frame to its session and address (0 = unknown).
+  Verdict admit_frame(TokenBucket &session, uint64_t address,
+                      clock::time_point now = clock::now()) {
+    if (per_session_.enabled() && !session.take(per_session_, now)) {
+      session_drops_.fetch_add(1, std::memory_order_relaxed);
+      return Verdict::session;
+    }
+    if (address != 0 && !take(address, now)) {
+      address_drops_.fetch_add(1, std::memory_order_relaxed);
+      return Verdict::address;
+    }
+    return Verdict::ok;
+  }
+
+  // Charges one WebSocket handshake to its address.
+  bool admit_handshake(uint64_t address, clock::time_point now = clock::now()) {
+    if (address == 0 || take(address, now))
+      return true;
+    handshake_drops_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  bool limits_addresses() const { return per_address_.enabled(); }
+
+  // Drop counters and the number of tracked addresses, for /metrics.
+  void render(std::string &out) const {
+    size_t addresses = 0;
+    for (auto &shard : shards_) {
+      std::lock_guard<std::mutex> guard{shard.mtx};
+      addresses += shard.buckets.size();
+    }
+    render_counter(out, "rplace_ratelimit_session_drops_total",
+                   session_drops_.load());
+    render_counter(out, "rplace_ratelimit_address_drops_total",
+                   address_drops_.load());
+    render_counter(out, "rplace_ratelimit_handshake_drops_total",
+                   handshake_drops_.load());
+    render_gauge(out, "rplace_ratelimit_tracked_addresses", addresses);
+  }
+
+private:
+  static constexpr size_t shard_count = 64;
+
+  struct Shard {
+    mutable std::mutex mtx;
+    std::unordered_map<uint64_t, TokenBucket> buckets;
+  };
+
+  bool take(uint64_t address, clock::time_point now) {
+    if (!per_address_.enabled())
+      return true;
+    auto &shard = shards_[((address >> 32) ^ address) % shard_count];
+    std::lock_guard<std::mutex> guard{shard.mtx};
+    auto &buckets = shard.buckets;
+    if (buckets.size() >= max_per_shard_ && !buckets.count(address)) {
+      for (auto i = buckets.begin(); i != buckets.end();)
+        i = i->second.full(per_address_, now) ? buckets.erase(i) : ++i;
+      // Still full: forget some address rather than grow without bound.
+      if (buckets.size() >= max_per_shard_)
+        buckets.erase(buckets.begin());
+    }
+    return buckets[address].take(per_address_, now);
+  }
+
+  RateLimit per_session_;
+  RateLimit per_address_;
+  size_t max_per_shard_;
+  std::array<Shard, shard_count> shards_;
+  std::atomic<uint64_t> session_drops_{0};
+  std::atomic<uint64_t> address_drops_{0};
+  std::atomic<uint64_t> handshake_drops_{0};
+};
+
+// Client address as reported by a reverse proxy: X-Real-IP, or else the
+// first entry of X-Forwarded-For. Empty if neither is set.
+template <class Header> std::string_view proxied_address(const Header &hdr) {
+  std::string_view addr = hdr.field("X-Real-IP");
+  if (addr.empty())
+    addr = hdr.field("X-Forwarded-For");
+  addr = addr.substr(0, addr.find(','));
+  while (!addr.empty() && addr.front() == ' ')
+    addr.remove_prefix(1);
+  while (!addr.empty() && addr.back() == ' ')
+    addr.remove_suffix(1);
+  return addr;
+}
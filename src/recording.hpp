@@ -0,0 +1,237 @@
+#pragma once
+
+#include "flusher.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Binary trace of incoming placements, for replaying real traffic with
+// `loadgen --replay`. A trace starts with the magic "RPTR" and a version
+// byte, followed by one record per placement:
+//
+//   varint  microseconds since the previous record
+//   varint  session (numbered from 1 in the order sessions started)
+//   varint  x
+//   varint  y
+//   varint  color
+//
+// Varints are LEB128, so a typical record takes 9 to 12 bytes.
+constexpr char recording_magic[4] = {'R', 'P', 'T', 'R'};
+constexpr uint8_t recording_version = 1;
+
+struct RecordedPlacement {
+  uint64_t time_us; // since the start of the trace
+  uint64_t session;
+  int32_t x;
+  int32_t y;
+  int32_t color;
+};
+
+// Appends placements to a trace file. Each thread buffers its records
+// separately, so recording does not serialize the session threads; the
+// shared Flusher thread merges the buffers in time order and writes them.
+class PlacementRecorder {
+public:
+  using clock = std::chrono::steady_clock;
+
+  // Touches flusher() first, so it outlives the static recorder().
+  PlacementRecorder() { flusher(); }
+
+  PlacementRecorder(const PlacementRecorder &) = delete;
+  PlacementRecorder &operator=(const PlacementRecorder &) = delete;
+
+  ~PlacementRecorder() { close(); }
+
+  bool open(const std::string &path) {
+    file_ = std::fopen(path.c_str(), "wb");
+    if (file_ == nullptr)
+      return false;
+    std::fwrite(recording_magic, 1, sizeof(recording_magic), file_);
+    std::fputc(recording_version, file_);
+    last_ = clock::now();
+    running_ = true;
+    enabled_.store(true, std::memory_order_relaxed);
+    flush_id_ = flusher().add([this] { flush(); });
+    return true;
+  }
+
+  void close() {
+    if (!running_)
+      return;
+    running_ = false;
+    enabled_.store(false, std::memory_order_relaxed);
+    flusher().remove(flush_id_);
+    flush();
+    std::fclose(file_);
+    file_ = nullptr;
+  }
+
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  // Number for a new session, 0 while not recording.
+  uint64_t next_session() {
+    if (!enabled())
+      return 0;
+    return next_session_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void record(uint64_t session, int32_t x, int32_t y, int32_t color) {
+    if (!enabled())
+      return;
+    auto &buf = local_buffer();
+    // Only contended while the flusher swaps the buffer out.
+    std::lock_guard<std::mutex> guard{buf.mtx};
+    buf.records.push_back(Pending{clock::now(), session, x, y, color});
+  }
+
+private:
+  struct Pending {
+    clock::time_point time;
+    uint64_t session;
+    int32_t x;
+    int32_t y;
+    int32_t color;
+  };
+
+  struct Buffer {
+    std::mutex mtx;
+    std::vector<Pending> records;
+  };
+
+  // The calling thread's buffer, registered on first use.
+  Buffer &local_buffer() {
+    thread_local const PlacementRecorder *owner = nullptr;
+    thread_local std::shared_ptr<Buffer> buf;
+    if (owner != this) {
+      buf = std::make_shared<Buffer>();
+      owner = this;
+      std::lock_guard<std::mutex> guard{buffers_mtx_};
+      buffers_.push_back(buf);
+    }
+    return *buf;
+  }
+
+  static void put_varint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+      out += static_cast<char>((value & 0x7F) | 0x80);
+      value >>= 7;
+    }
+    out += static_cast<char>(value);
+  }
+
+  // Runs on the flusher thread, or in close() after it was unregistered.
+  void flush() {
+    std::vector<Pending> records;
+    {
+      std::lock_guard<std::mutex> guard{buffers_mtx_};
+      for (auto &buf : buffers_) {
+        std::lock_guard<std::mutex> buf_guard{buf->mtx};
+        records.insert(records.end(), buf->records.begin(),
+                       buf->records.end());
+        buf->records.clear();
+      }
+    }
+    if (records.empty())
+      return;
+    std::stable_sort(records.begin(), records.end(),
+                     [](const Pending &a, const Pending &b) {
+                       return a.time < b.time;
+                     });
+    std::string out;
+    for (auto &rec : records) {
+      // A thread may take its timestamp just before one flush and push the
+      // record just after it, so a record can predate the last one written.
+      auto delta = std::max(clock::duration::zero(), rec.time - last_);
+      auto us = std::chrono::duration_cast<std::chrono::microseconds>(delta);
+      // Keep the remainder, or sub-microsecond gaps would add up to drift.
+      last_ += us;
+      put_varint(out, static_cast<uint64_t>(us.count()));
+      put_varint(out, rec.session);
+      put_varint(out, static_cast<uint32_t>(rec.x));
+      put_varint(out, static_cast<uint32_t>(rec.y));
+      put_varint(out, static_cast<uint32_t>(rec.color));
+    }
+    std::fwrite(out.data(), 1, out.size(), file_);
+    std::fflush(file_);
+  }
+
+  std::atomic<bool> enabled_{false};
+  std::atomic<uint64_t> next_session_{1};
+  std::FILE *file_ = nullptr;
+  std::mutex buffers_mtx_;
+  std::vector<std::shared_ptr<Buffer>> buffers_;
+  clock::time_point last_; // only touched by flush()
+  bool running_ = false;
+  uint64_t flush_id_ = 0;
+};
+
+inline PlacementRecorder &recorder() {
+  static PlacementRecorder instance;
+  return instance;
+}
+
+// Reads a trace written by PlacementRecorder, one record at a time.
+class RecordingReader {
+public:
+  RecordingReader() = default;
+
+  RecordingReader(const RecordingReader &) = delete;
+  RecordingReader &operator=(const RecordingReader &) = delete;
+
+  ~RecordingReader() {
+    if (file_ != nullptr)
+      std::fclose(file_);
+  }
+
+  bool open(const std::string &path) {
+    file_ = std::fopen(path.c_str(), "rb");
+    if (file_ == nullptr)
+      return false;
+    char magic[sizeof(recording_magic)];
+    if (std::fread(magic, 1, sizeof(magic), file_) != sizeof(magic) ||
+        !std::equal(magic, magic + sizeof(magic), recording_magic))
+      return false;
+    return std::fgetc(file_) == recording_version;
+  }
+
+  // False at the end of the trace or on a truncated record.
+  bool next(RecordedPlacement &out) {
+    uint64_t delta = 0;
+    uint64_t x = 0;
+    uint64_t y = 0;
+    uint64_t color = 0;
+    if (!get_varint(delta) || !get_varint(out.session) || !get_varint(x) ||
+        !get_varint(y) || !get_varint(color))
+      return false;
+    time_us_ += delta;
+    out.time_us = time_us_;
+    out.x = static_cast<int32_t>(x);
+    out.y = static_cast<int32_t>(y);
+    out.color = static_cast<int32_t>(color);
+    return true;
+  }
+
+private:
+  bool get_varint(uint64_t &out) {
+    out = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      auto c = std::fgetc(file_);
+      if (c == EOF)
+        return false;
+      out |= static_cast<uint64_t>(c & 0x7F) << shift;
+      if ((c & 0x80) == 0)
+        return true;
+    }
+    return false;
+  }
+
+  std::FILE *file_ = nullptr;
+  uint64_t time_us_ = 0;
+};
@@ -0,0 +1,311 @@
+#pragma once
+
+#include "listener.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // SO_NOSIGPIPE is set per socket instead
+#endif
+
+// Read-only Server-Sent Events stream of canvas batches for spectators:
+//
+//   GET /stream  ->  data: {"type":"batch",...}\n\n  per batch
+//
+// Spectators never send anything after the request, so instead of a
+// WebSocket session each one is just a socket plus a queue of references to
+// the batch text the canvas already encoded for WebSocket sessions. A single
+// thread multiplexes all of them with poll(). Spectators that fall more than
+// `max_queued` batches behind are disconnected; EventSource clients reconnect
+// on their own and can refetch tiles over HTTP.
+class SpectatorHub {
+public:
+  // Shared encoded text. `owner` keeps the bytes behind `text` alive.
+  struct Payload {
+    std::shared_ptr<const void> owner;
+    std::string_view text;
+  };
+
+  explicit SpectatorHub(size_t max_queued = 64) : max_queued_(max_queued) {}
+
+  SpectatorHub(const SpectatorHub &) = delete;
+  SpectatorHub &operator=(const SpectatorHub &) = delete;
+
+  ~SpectatorHub() { stop(); }
+
+  bool start(uint16_t port, int buffer_size, std::string &err) {
+    listen_fd_ = make_listen_socket(port, buffer_size, false, err);
+    if (listen_fd_ < 0)
+      return false;
+    if (pipe(wake_) != 0) {
+      err = std::string{"pipe: "} + std::strerror(errno);
+      close(listen_fd_);
+      listen_fd_ = -1;
+      return false;
+    }
+    fcntl(wake_[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_[1], F_SETFL, O_NONBLOCK);
+    running_ = true;
+    thread_ = std::thread{[this] { run(); }};
+    return true;
+  }
+
+  void stop() {
+    if (!running_.exchange(false))
+      return;
+    wake();
+    thread_.join();
+    for (auto &spectator : spectators_)
+      close(spectator.fd);
+    spectators_.clear();
+    close(listen_fd_);
+    close(wake_[0]);
+    close(wake_[1]);
+  }
+
+  // Queues one batch for every streaming spectator. Thread-safe.
+  void publish(Payload payload) {
+    if (!running_ || count_ == 0)
+      return;
+    {
+      std::lock_guard<std::mutex> guard{mtx_};
+      incoming_.push_back(std::move(payload));
+    }
+    wake();
+  }
+
+  size_t spectators() const { return count_; }
+
+private:
+  struct Chunk {
+    std::shared_ptr<const void> owner;
+    std::string_view text;
+    bool event; // framed as "data: <text>\n\n"
+  };
+
+  struct Spectator {
+    int fd = -1;
+    bool streaming = false;
+    std::string request;
+    std::deque<Chunk> queue;
+    size_t offset = 0; // bytes of the front chunk already written
+  };
+
+  static constexpr std::string_view prefix = "data: ";
+  static constexpr std::string_view suffix = "\n\n";
+  static constexpr std::string_view keepalive = ":\n\n";
+  static constexpr std::string_view accepted =
+      "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+      "Cache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n";
+  static constexpr std::string_view not_found =
+      "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n"
+      "Connection: close\r\n\r\n";
+  static constexpr size_t max_request_size = 4096;
+  static constexpr auto keepalive_interval = std::chrono::seconds(15);
+
+  void wake() {
+    if (!signaled_.exchange(true)) {
+      char c = 0;
+      [[maybe_unused]] auto n = write(wake_[1], &c, 1);
+    }
+  }
+
+  void run() {
+    std::vector<pollfd> fds;
+    auto next_keepalive =
+        std::chrono::steady_clock::now() + keepalive_interval;
+    while (running_) {
+      fds.clear();
+      fds.push_back(pollfd{wake_[0], POLLIN, 0});
+      fds.push_back(pollfd{listen_fd_, POLLIN, 0});
+      for (auto &spectator : spectators_) {
+        short events = spectator.streaming ? 0 : POLLIN;
+        if (!spectator.queue.empty())
+          events |= POLLOUT;
+        fds.push_back(pollfd{spectator.fd, events, 0});
+      }
+      auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+          next_keepalive - std::chrono::steady_clock::now());
+      poll(fds.data(), fds.size(),
+           static_cast<int>(std::max<int64_t>(0, timeout.count())));
+      if (fds[0].revents & POLLIN)
+        drain_incoming();
+      if (std::chrono::steady_clock::now() >= next_keepalive) {
+        for (auto &spectator : spectators_)
+          if (spectator.streaming && spectator.queue.empty())
+            spectator.queue.push_back(Chunk{nullptr, keepalive, false});
+        next_keepalive += keepalive_interval;
+      }
+      // Sockets that were polled sit at the front of spectators_, in order.
+      for (size_t i = 2; i < fds.size(); ++i) {
+        auto &spectator = spectators_[i - 2];
+        if (spectator.fd < 0)
+          continue;
+        if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+          drop(spectator);
+          continue;
+        }
+        if (fds[i].revents & POLLIN)
+          read_request(spectator);
+        if (spectator.fd >= 0 && !spectator.queue.empty())
+          flush(spectator);
+      }
+      if (fds[1].revents & POLLIN)
+        accept_all();
+      spectators_.erase(std::remove_if(spectators_.begin(), spectators_.end(),
+                                       [](const Spectator &spectator) {
+                                         return spectator.fd < 0;
+                                       }),
+                        spectators_.end());
+      count_ = spectators_.size();
+    }
+  }
+
+  void drain_incoming() {
+    char buf[64];
+    while (read(wake_[0], buf, sizeof(buf)) > 0)
+      ; // nop
+    signaled_ = false;
+    std::vector<Payload> batches;
+    {
+      std::lock_guard<std::mutex> guard{mtx_};
+      batches.swap(incoming_);
+    }
+    for (auto &spectator : spectators_) {
+      if (!spectator.streaming)
+        continue;
+      if (spectator.queue.size() + batches.size() > max_queued_) {
+        drop(spectator);
+        continue;
+      }
+      for (auto &batch : batches)
+        spectator.queue.push_back(Chunk{batch.owner, batch.text, true});
+    }
+  }
+
+  void accept_all() {
+    for (;;) {
+      int fd = accept(listen_fd_, nullptr, nullptr);
+      if (fd < 0)
+        return;
+      fcntl(fd, F_SETFL, O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+      int on = 1;
+      setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+      spectators_.emplace_back();
+      spectators_.back().fd = fd;
+    }
+  }
+
+  void read_request(Spectator &spectator) {
+    char buf[1024];
+    auto n = read(spectator.fd, buf, sizeof(buf));
+    if (n <= 0) {
+      if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        drop(spectator);
+      return;
+    }
+    spectator.request.append(buf, static_cast<size_t>(n));
+    if (spectator.request.find("\r\n\r\n") == std::string::npos) {
+      if (spectator.request.size() > max_request_size)
+        drop(spectator);
+      return;
+    }
+    std::string_view line{spectator.request};
+    auto ok = line.substr(0, 12) == "GET /stream " ||
+              line.substr(0, 12) == "GET /stream?";
+    std::string{}.swap(spectator.request);
+    if (!ok) {
+      [[maybe_unused]] auto sent = send(spectator.fd, not_found.data(),
+                                        not_found.size(), MSG_NOSIGNAL);
+      drop(spectator);
+      return;
+    }
+    spectator.streaming = true;
+    spectator.queue.push_back(Chunk{nullptr, accepted, false});
+  }
+
+  void flush(Spectator &spectator) {
+    iovec iov[48];
+    int count = 0;
+    for (auto &chunk : spectator.queue) {
+      if (count + 3 > 48)
+        break;
+      if (chunk.event) {
+        iov[count++] = to_iovec(prefix);
+        iov[count++] = to_iovec(chunk.text);
+        iov[count++] = to_iovec(suffix);
+      } else {
+        iov[count++] = to_iovec(chunk.text);
+      }
+    }
+    // Skip what previous partial writes already sent.
+    auto skip = spectator.offset;
+    int first = 0;
+    while (skip > 0 && skip >= iov[first].iov_len)
+      skip -= iov[first++].iov_len;
+    iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + skip;
+    iov[first].iov_len -= skip;
+    msghdr msg{};
+    msg.msg_iov = iov + first;
+    msg.msg_iovlen = count - first;
+    auto n = sendmsg(spectator.fd, &msg, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        drop(spectator);
+      return;
+    }
+    // Pop all chunks that went out completely.
+    auto written = spectator.offset + static_cast<size_t>(n);
+    while (!spectator.queue.empty()) {
+      auto &front = spectator.queue.front();
+      auto len = front.text.size() +
+                 (front.event ? prefix.size() + suffix.size() : 0);
+      if (written < len)
+        break;
+      written -= len;
+      spectator.queue.pop_front();
+    }
+    spectator.offset = written;
+  }
+
+  void drop(Spectator &spectator) {
+    if (spectator.fd >= 0) {
+      close(spectator.fd);
+      spectator.fd = -1;
+    }
+    spectator.queue.clear();
+  }
+
+  static iovec to_iovec(std::string_view str) {
+    return iovec{const_cast<char *>(str.data()), str.size()};
+  }
+
+  size_t max_queued_;
+  int listen_fd_ = -1;
+  int wake_[2] = {-1, -1};
+  std::atomic<bool> running_{false};
+  std::atomic<bool> signaled_{false};
+  std::atomic<size_t> count_{0};
+  std::thread thread_;
+  std::mutex mtx_;
+  std::vector<Payload> incoming_;
+  std::vector<Spectator> spectators_; // only touched by thread_
+};
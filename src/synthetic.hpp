@@ -0,0 +1,154 @@
+#pragma once
+
+#include "canvas.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string_view>
+
+// Where synthetic placements land. Real canvases see both: most users paint
+// all over the board, while a few popular spots attract a lot of them.
+enum class Distribution {
+  uniform, // every pixel equally likely
+  zipf,    // pixel popularity follows a Zipf law
+  hotspot, // a share of placements goes to one square, the rest is uniform
+};
+
+inline bool parse_distribution(std::string_view str, Distribution &out) {
+  if (str == "uniform")
+    out = Distribution::uniform;
+  else if (str == "zipf")
+    out = Distribution::zipf;
+  else if (str == "hotspot")
+    out = Distribution::hotspot;
+  else
+    return false;
+  return true;
+}
+
+// Shape of the in-process load, see synthetic_load in main.cpp.
+struct LoadProfile {
+  double rate = 0;       // placements per second outside bursts, 0 = off
+  size_t users = 1000;   // virtual users, each with one placement in flight
+  Distribution distribution = Distribution::uniform;
+  double zipf_exponent = 1.0;
+  int hotspot_size = 50;      // edge length of the hot square
+  double hotspot_share = 0.9; // placements that go to the hot square
+  std::chrono::milliseconds burst_every{0}; // 0 = steady rate
+  std::chrono::milliseconds burst_length{1000};
+  double burst_factor = 10; // rate multiplier during a burst
+
+  // Placements per second `elapsed` after the start.
+  double rate_at(std::chrono::steady_clock::duration elapsed) const {
+    if (burst_every.count() <= 0)
+      return rate;
+    auto phase = elapsed % burst_every;
+    return phase < burst_length ? rate * burst_factor : rate;
+  }
+};
+
+// Zipf distribution over 1..n, by rejection-inversion (Hörmann and
+// Derflinger, 1996): constant time per sample and no table, so it works for
+// the ~1M pixels of the canvas.
+class ZipfDistribution {
+public:
+  ZipfDistribution(uint64_t n, double exponent)
+      : n_(n), exponent_(exponent), h_x1_(h_integral(1.5) - 1.0),
+        h_n_(h_integral(static_cast<double>(n) + 0.5)),
+        s_(2.0 - h_integral_inverse(h_integral(2.5) - h(2.0))) {}
+
+  template <class Rng> uint64_t operator()(Rng &rng) {
+    std::uniform_real_distribution<double> unit;
+    for (;;) {
+      auto u = h_n_ + unit(rng) * (h_x1_ - h_n_);
+      auto x = h_integral_inverse(u);
+      auto k = std::clamp<uint64_t>(static_cast<uint64_t>(x + 0.5), 1, n_);
+      if (static_cast<double>(k) - x <= s_ ||
+          u >= h_integral(static_cast<double>(k) + 0.5) -
+                   h(static_cast<double>(k)))
+        return k;
+    }
+  }
+
+private:
+  double h(double x) const { return std::exp(-exponent_ * std::log(x)); }
+
+  double h_integral(double x) const {
+    auto log_x = std::log(x);
+    return helper2((1.0 - exponent_) * log_x) * log_x;
+  }
+
+  double h_integral_inverse(double x) const {
+    auto t = std::max(x * (1.0 - exponent_), -1.0);
+    return std::exp(helper1(t) * x);
+  }
+
+  // log1p(x) / x and expm1(x) / x, stable around 0.
+  static double helper1(double x) {
+    if (std::abs(x) > 1e-8)
+      return std::log1p(x) / x;
+    return 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+  }
+
+  static double helper2(double x) {
+    if (std::abs(x) > 1e-8)
+      return std::expm1(x) / x;
+    return 1.0 + x * 0.5 * (1.0 + x / 3.0 * (1.0 + 0.25 * x));
+  }
+
+  uint64_t n_;
+  double exponent_;
+  double h_x1_;
+  double h_n_;
+  double s_;
+};
+
+// Draws placement coordinates according to a LoadProfile.
+class PixelPicker {
+public:
+  explicit PixelPicker(const LoadProfile &profile)
+      : profile_(profile), zipf_(uint64_t{DIM} * DIM, profile.zipf_exponent),
+        hot_edge_(std::clamp(profile.hotspot_size, 1, DIM)),
+        hot_origin_((DIM - hot_edge_) / 2) {}
+
+  template <class Rng> Pixel operator()(Rng &rng) {
+    switch (profile_.distribution) {
+      case Distribution::zipf: {
+        // Spread the ranks over the board, or the hottest pixels would all
+        // sit in the first row. 999'983 is prime and does not divide DIM²,
+        // so this maps ranks to pixels one to one.
+        auto rank = zipf_(rng) - 1;
+        auto index = static_cast<int>((rank * 999'983) % (uint64_t{DIM} * DIM));
+        return Pixel{index % DIM, index / DIM, color(rng)};
+      }
+      case Distribution::hotspot:
+        if (std::uniform_real_distribution<double>{}(rng) <
+            profile_.hotspot_share) {
+          std::uniform_int_distribution<int> hot(0, hot_edge_ - 1);
+          auto x = hot_origin_ + hot(rng);
+          auto y = hot_origin_ + hot(rng);
+          return Pixel{x, y, color(rng)};
+        }
+        [[fallthrough]];
+      default: {
+        std::uniform_int_distribution<int> coord(0, DIM - 1);
+        auto x = coord(rng);
+        auto y = coord(rng);
+        return Pixel{x, y, color(rng)};
+      }
+    }
+  }
+
+private:
+  template <class Rng> static int color(Rng &rng) {
+    return std::uniform_int_distribution<int>{0, 0xFFFFFF}(rng);
+  }
+
+  LoadProfile profile_;
+  ZipfDistribution zipf_;
+  int hot_edge_;
+  int hot_origin_;
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "canvas.hpp"
+#include "encoding.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class TileFormat { png, raw };
+
+// Random id chosen once per process. Tile versions restart at 0 with every
+// process, so entity tags carry this to never match a tag from a previous run.
+inline const std::string &tile_epoch() {
+  static const std::string instance = [] {
+    std::random_device rd;
+    auto id = (uint64_t{rd()} << 32) | rd();
+    char buf[17];
+    std::snprintf(buf, sizeof(buf), "%016llx",
+                  static_cast<unsigned long long>(id));
+    return std::string{buf};
+  }();
+  return instance;
+}
+
+// Immutable copy of one tile at a given version. Encodings are produced on
+// first use by whichever thread asks for them and then kept with the tile.
+class Tile {
+public:
+  Tile(int index, uint64_t version, std::vector<int> colors)
+      : index_(index), version_(version), colors_(std::move(colors)) {}
+
+  int index() const { return index_; }
+
+  uint64_t version() const { return version_; }
+
+  // Quoted entity tag, e.g. "9f86d081884c7d65-3-1742". Unique per process,
+  // tile and version.
+  std::string etag() const {
+    return '"' + tile_epoch() + '-' + std::to_string(index_) + '-' +
+           std::to_string(version_) + '"';
+  }
+
+  const std::vector<std::byte> &encoded(TileFormat format) const {
+    if (format == TileFormat::png) {
+      std::call_once(png_once_,
+                     [this] { encode_png(TILE, TILE, colors_, png_); });
+      return png_;
+    }
+    // Raw: TILE * TILE little-endian u32 colors in row-major order.
+    std::call_once(raw_once_, [this] {
+      raw_.reserve(colors_.size() * 4);
+      for (auto color : colors_)
+        for (int b = 0; b < 4; ++b)
+          raw_.push_back(static_cast<std::byte>(
+              (static_cast<uint32_t>(color) >> (8 * b)) & 0xFF));
+    });
+    return raw_;
+  }
+
+private:
+  int index_;
+  uint64_t version_;
+  std::vector<int> colors_;
+  mutable std::once_flag png_once_;
+  mutable std::once_flag raw_once_;
+  mutable std::vector<std::byte> png_;
+  mutable std::vector<std::byte> raw_;
+};
+
+using TilePtr = std::shared_ptr<const Tile>;
+
+// Latest version of every tile, written by the canvas actor after each batch
+// and read by the HTTP server threads.
+class TileCache {
+public:
+  void update(TilePtr tile) {
+    std::lock_guard<std::mutex> guard{mtx_};
+    tiles_[tile->index()] = std::move(tile);
+  }
+
+  TilePtr get(int index) const {
+    std::lock_guard<std::mutex> guard{mtx_};
+    return tiles_[index];
+  }
+
+private:
+  mutable std::mutex mtx_;
+  std::array<TilePtr, Canvas::tile_count> tiles_;
+};
+
+// Checks an If-None-Match header value (a list of entity tags or "*")
+// against `etag`. Weak tags compare equal to their strong counterpart.
+inline bool etag_matches(std::string_view header, std::string_view etag) {
+  while (!header.empty()) {
+    auto sep = header.find(',');
+    auto item = header.substr(0, sep);
+    header = sep == std::string_view::npos ? std::string_view{}
+                                           : header.substr(sep + 1);
+    while (!item.empty() && item.front() == ' ')
+      item.remove_prefix(1);
+    while (!item.empty() && item.back() == ' ')
+      item.remove_suffix(1);
+    if (item.substr(0, 2) == "W/")
+      item.remove_prefix(2);
+    if (item == "*" || item == etag)
+      return true;
+  }
+  return false;
+}
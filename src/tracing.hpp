@@ -0,0 +1,121 @@
+#pragma once
+
+#include "flusher.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Head-sampled tracing of individual placements. Every `every`-th frame per
+// thread gets a trace id; all spans of that placement are then written as
+// complete ("X") events in the Chrome trace event format, one row per trace,
+// so the file opens directly in chrome://tracing or ui.perfetto.dev.
+// Spans are buffered in memory and written by the shared Flusher thread.
+class Tracer {
+public:
+  using clock = std::chrono::steady_clock;
+
+  // Touches flusher() first, so it outlives the static tracer().
+  Tracer() { flusher(); }
+
+  Tracer(const Tracer &) = delete;
+  Tracer &operator=(const Tracer &) = delete;
+
+  ~Tracer() { close(); }
+
+  bool open(const std::string &path, uint32_t every) {
+    file_ = std::fopen(path.c_str(), "w");
+    if (file_ == nullptr)
+      return false;
+    std::fputs("[\n", file_);
+    every_.store(every, std::memory_order_relaxed);
+    running_ = true;
+    flush_id_ = flusher().add([this] { flush(); });
+    return true;
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> guard{mtx_};
+      if (!running_)
+        return;
+      running_ = false;
+    }
+    every_.store(0, std::memory_order_relaxed);
+    flusher().remove(flush_id_);
+    flush();
+    std::fputs("\n]\n", file_);
+    std::fclose(file_);
+    file_ = nullptr;
+  }
+
+  // Returns a fresh trace id for every `every`-th call per thread, else 0.
+  uint64_t sample() {
+    auto every = every_.load(std::memory_order_relaxed);
+    if (every == 0)
+      return 0;
+    thread_local uint32_t count = 0;
+    if (++count % every != 0)
+      return 0;
+    return next_id_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Records one span of trace `id`; a no-op for id 0.
+  void span(uint64_t id, std::string_view name, clock::time_point start,
+            clock::time_point end) {
+    if (id == 0)
+      return;
+    char buf[192];
+    auto n = std::snprintf(
+        buf, sizeof(buf),
+        "{\"name\":\"%.*s\",\"cat\":\"placement\",\"ph\":\"X\",\"pid\":1,"
+        "\"tid\":%llu,\"ts\":%.3f,\"dur\":%.3f}",
+        static_cast<int>(name.size()), name.data(),
+        static_cast<unsigned long long>(id), micros(start - epoch_),
+        micros(end - start));
+    if (n <= 0)
+      return;
+    std::lock_guard<std::mutex> guard{mtx_};
+    if (!pending_.empty() || written_)
+      pending_ += ",\n";
+    pending_.append(buf, std::min<size_t>(static_cast<size_t>(n), sizeof(buf)));
+  }
+
+private:
+  static double micros(clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+  }
+
+  void flush() {
+    std::string out;
+    {
+      std::lock_guard<std::mutex> guard{mtx_};
+      out.swap(pending_);
+      written_ = written_ || !out.empty();
+    }
+    if (!out.empty()) {
+      std::fwrite(out.data(), 1, out.size(), file_);
+      std::fflush(file_);
+    }
+  }
+
+  const clock::time_point epoch_ = clock::now();
+  std::atomic<uint32_t> every_{0}; // 0 = tracing off
+  std::atomic<uint64_t> next_id_{1};
+  std::FILE *file_ = nullptr;
+  std::mutex mtx_;
+  std::string pending_;
+  bool written_ = false; // any span left pending_ yet
+  bool running_ = false;
+  uint64_t flush_id_ = 0;
+};
+
+inline Tracer &tracer() {
+  static Tracer instance;
+  return instance;
+}